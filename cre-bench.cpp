@@ -0,0 +1,459 @@
+// cre-bench, times cre against std::regex over a fixed catalog of patterns
+//
+//   g++ -std=c++17 -O2 -o cre-bench cre-bench.cpp -pthread
+//   cre-bench [-cLJNx] [-s bytes] [-r bytes] [name...]
+//
+// the corpora are generated from a fixed seed, so every run of every version scans
+// the same input: log lines, html, random bytes and runs of a that make a
+// backtracking matcher go exponential. for every pattern, or the ones named, it
+// reports for cre and std::regex side by side the compile time, the heap the
+// compiled pattern holds, the throughput of match and search on every line and of
+// matches and replace over the whole corpus, and the number of matches found;
+// std::regex scans only the first lines of a corpus, it is too slow for all of it
+
+#include "cre.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace
+{
+// the bytes allocated and not yet freed, counted by the operator new below
+std::atomic<std::size_t> heap(0);
+} // namespace
+
+// every block keeps its size in front of it, so delete can count what it frees;
+// delete is not inlined, where it is gcc takes the free of a block for a mismatch
+void *operator new(std::size_t size)
+{
+    auto block = static_cast<std::max_align_t *>(std::malloc(size + sizeof(std::max_align_t)));
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<std::size_t *>(block) = size;
+    heap += size;
+    return block + 1;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    if (p)
+    {
+        auto block = static_cast<std::max_align_t *>(p) - 1;
+        heap -= *reinterpret_cast<std::size_t *>(block);
+        std::free(block);
+    }
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// every timing repeats its run for at least this long
+constexpr double MIN_SECONDS = 0.2;
+
+class Flags
+{
+  public:
+    bool csv, std_regex;
+    cre::Engine engine;
+    // bytes of every corpus, and of the lines of it std::regex scans
+    std::size_t size, std_size;
+
+    Flags() : csv(false), std_regex(true), engine(cre::Engine::DFA), size(1 << 20), std_size(1 << 18) {}
+};
+
+// a pattern of the catalog in both syntaxes, cre's names its subexpressions
+class Entry
+{
+  public:
+    const char *name, *corpus, *pattern, *std_pattern;
+};
+
+#define CRE_IPV4_BYTE "25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9]"
+
+const Entry CATALOG[] =
+{
+    {"ipv4", "logs", "(?:<sec>" CRE_IPV4_BYTE ")(\\.(?:<sec>)){3}", "(" CRE_IPV4_BYTE ")(\\.(" CRE_IPV4_BYTE ")){3}"},
+    {"literal", "logs", "ERROR", "ERROR"},
+    {"levels", "logs", "ERROR|WARN|FATAL", "ERROR|WARN|FATAL"},
+    {"timestamp", "logs", "[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9]{2}:[0-9]{2}:[0-9]{2}",
+        "[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9]{2}:[0-9]{2}:[0-9]{2}"},
+    {"duration", "logs", "took [0-9]+ms", "took [0-9]+ms"},
+    // the unanchored dfa of this takes a state per set of threads alive, cre determinizes it while scanning
+    {"counted", "logs", "r[a-z ]{2,50}s", "r[a-z ]{2,50}s"},
+    {"meta", "html", "<meta[^>]*>", "<meta[^>]*>"},
+    {"href", "html", "href=\"[^\"]*\"", "href=\"[^\"]*\""},
+    {"tag", "html", "<[a-z]+( [a-z]+=\"[^\"]*\")*>", "<[a-z]+( [a-z]+=\"[^\"]*\")*>"},
+    {"suffix", "html", "[a-zA-Z]+ing", "[a-zA-Z]+ing"},
+    // the literals of these fan out from one first byte, a memchr for it outruns a search for all of them
+    {"fan_out", "random", "x[a-c]z", "x[a-c]z"},
+    {"fan_out_any", "random", "x[^\n]*z", "x[^\n]*z"},
+    // the dfas of these take a state for every combination of the last bytes
+    {"dfa_blowup", "random", "[a-q][^u-z]{13}x", "[a-q][^u-z]{13}x"},
+    {"nth_from_end", "pathological", "(a|b)*a(a|b){12}", "(a|b)*a(a|b){12}"},
+    // a backtracking matcher tries every way to split the run of a
+    {"backtrack", "pathological", "(a|aa)*b", "(a|aa)*b"},
+};
+
+#undef CRE_IPV4_BYTE
+
+void usage()
+{
+    std::fprintf(stderr,
+        "usage: cre-bench [-cLJNx] [-s bytes] [-r bytes] [name...]\n"
+        "  -c  print comma separated values with a header line\n"
+        "  -L  use the lazy dfa engine\n"
+        "  -J  use the jit engine\n"
+        "  -N  use the nfa engine\n"
+        "  -x  leave std::regex out\n"
+        "  -s  bytes of every corpus, 1 MiB by default\n"
+        "  -r  bytes of every corpus std::regex scans, 256 KiB by default\n"
+        "patterns:");
+    for (auto &entry: CATALOG)
+    {
+        std::fprintf(stderr, " %s", entry.name);
+    }
+    std::fprintf(stderr, "\n");
+    std::exit(2);
+}
+
+// lines of words, numbers and addresses of an application log
+std::string logs(std::size_t size, std::mt19937 &random)
+{
+    const char *levels[] = {"DEBUG", "INFO", "INFO", "INFO", "WARN", "ERROR"};
+    const char *events[] = {"request from", "connection reset by", "retrying upstream", "cache miss for", "timeout talking to"};
+    const char *words[] = {"users", "orders", "session", "payments", "search", "index", "worker", "shard"};
+    std::string res;
+    char line[256];
+    while (res.size() < size)
+    {
+        auto pick = [&](std::size_t n) { return static_cast<std::size_t>(random() % n); };
+        std::snprintf(line, sizeof(line), "2024-%02zu-%02zu %02zu:%02zu:%02zu %s [%s-%zu] %s %zu.%zu.%zu.%zu /%s/%zu took %zums\n",
+            1 + pick(12), 1 + pick(28), pick(24), pick(60), pick(60), levels[pick(6)], words[pick(8)], pick(16),
+            events[pick(5)], pick(300), pick(256), pick(256), pick(256), words[pick(8)], pick(100000), pick(5000));
+        res += line;
+    }
+    res.resize(size);
+    return res;
+}
+
+// a page of nested tags with attributes and text, one element a line
+std::string html(std::size_t size, std::mt19937 &random)
+{
+    const char *words[] = {"loading", "the", "page", "of", "rendering", "content", "with", "nothing", "string", "data"};
+    const char *tags[] = {"div", "span", "p", "li", "td"};
+    std::string res = "<html><head><meta charset=\"utf-8\"><title>bench</title></head><body>\n";
+    while (res.size() < size)
+    {
+        auto pick = [&](std::size_t n) { return static_cast<std::size_t>(random() % n); };
+        auto tag = tags[pick(5)];
+        switch (pick(4))
+        {
+        case 0:
+            res += "<meta name=\"" + std::string(words[pick(10)]) + "\" content=\"" + words[pick(10)] + "\">\n";
+            break;
+        case 1:
+            res += "<a href=\"/" + std::string(words[pick(10)]) + "/" + std::to_string(pick(1000)) + "\">"
+                + words[pick(10)] + "</a>\n";
+            break;
+        default:
+            res += "<" + std::string(tag) + " class=\"" + words[pick(10)] + "\">";
+            for (auto n = 3 + pick(12); n; --n)
+            {
+                res += words[pick(10)];
+                res += n > 1 ? " " : "";
+            }
+            res += "</" + std::string(tag) + ">\n";
+        }
+    }
+    res.resize(size);
+    return res;
+}
+
+std::string bytes(std::size_t size, std::mt19937 &random)
+{
+    std::string res(size, '\0');
+    for (auto &c: res)
+    {
+        c = static_cast<char>(random());
+    }
+    return res;
+}
+
+// lines of a run of a and no b, the length of the runs keeps a backtracking
+// matcher of (a|aa)*b in seconds on the lines std::regex scans
+std::string pathological(std::size_t size, std::mt19937 &random)
+{
+    std::string res;
+    while (res.size() < size)
+    {
+        res += std::string(10 + random() % 10, 'a') + "\n";
+    }
+    res.resize(size);
+    return res;
+}
+
+// the prefix of text that ends with the last whole line within size bytes
+std::string_view head(std::string_view text, std::size_t size)
+{
+    if (text.size() <= size)
+    {
+        return text;
+    }
+    auto end = text.rfind('\n', size);
+    return text.substr(0, end == std::string_view::npos ? size : end + 1);
+}
+
+std::vector<std::string_view> split(std::string_view text)
+{
+    std::vector<std::string_view> res;
+    for (std::size_t begin = 0; begin < text.size(); )
+    {
+        auto end = text.find('\n', begin);
+        end = end == std::string_view::npos ? text.size() : end;
+        res.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return res;
+}
+
+double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// MB/s of run over bytes of input, NaN if run throws, as std::regex may
+// once the stack or the steps of a backtracking match run out
+template <typename Run>
+double throughput(std::size_t bytes, Run run)
+{
+    try
+    {
+        std::size_t rounds = 0;
+        auto start = Clock::now();
+        do
+        {
+            run();
+            ++rounds;
+        } while (seconds(start) < MIN_SECONDS);
+        return bytes * rounds / seconds(start) / 1e6;
+    }
+    catch (const std::exception &)
+    {
+        return NAN;
+    }
+}
+
+// the timings of one library on one pattern
+class Result
+{
+  public:
+    std::string lib;
+    double compile_us;
+    std::size_t memory, input, count;
+    double match, search, matches, replace;
+
+    Result(std::string lib) : lib(std::move(lib)), compile_us(NAN), memory(0), input(0), count(0),
+        match(NAN), search(NAN), matches(NAN), replace(NAN) {}
+};
+
+// the mean time of compiling with make, and the heap the last compiled one holds
+template <typename Make>
+void compile(Result &result, Make make)
+{
+    std::size_t rounds = 0;
+    auto start = Clock::now();
+    do
+    {
+        auto before = heap.load();
+        auto compiled = make();
+        result.memory = sizeof(compiled) + heap.load() - before;
+        ++rounds;
+    } while (seconds(start) < MIN_SECONDS);
+    result.compile_us = seconds(start) / rounds * 1e6;
+}
+
+Result bench_cre(const Entry &entry, const Flags &flags, std::string_view text)
+{
+    cre::Options options;
+    options.engine = flags.engine;
+    Result result("cre");
+    compile(result, [&] { return cre::Pattern(entry.pattern, options); });
+    cre::Pattern pattern(entry.pattern, options);
+    const char *engines[] = {"dfa", "lazy dfa", "jit", "nfa"};
+    result.lib += std::string(" ") + engines[static_cast<int>(pattern.engine())];
+
+    result.input = text.size();
+    auto lines = split(text);
+    std::size_t found = 0;
+    result.match = throughput(text.size(), [&]
+    {
+        for (auto line: lines)
+        {
+            found += !pattern.match(line).empty();
+        }
+    });
+    result.search = throughput(text.size(), [&]
+    {
+        for (auto line: lines)
+        {
+            found += !pattern.search(line).empty();
+        }
+    });
+    result.matches = throughput(text.size(), [&] { result.count = pattern.matches_span(text).size(); });
+    result.replace = throughput(text.size(), [&] { found += pattern.replace(text, "#").size(); });
+    return result;
+}
+
+Result bench_std(const Entry &entry, std::string_view text)
+{
+    Result result("std::regex");
+    try
+    {
+        compile(result, [&] { return std::regex(entry.std_pattern, std::regex::optimize); });
+    }
+    catch (const std::regex_error &)
+    {
+        return result;
+    }
+    std::regex pattern(entry.std_pattern, std::regex::optimize);
+
+    result.input = text.size();
+    auto lines = split(text);
+    std::string copy(text);
+    std::size_t found = 0;
+    result.match = throughput(text.size(), [&]
+    {
+        for (auto line: lines)
+        {
+            found += std::regex_match(line.begin(), line.end(), pattern);
+        }
+    });
+    result.search = throughput(text.size(), [&]
+    {
+        for (auto line: lines)
+        {
+            found += std::regex_search(line.begin(), line.end(), pattern);
+        }
+    });
+    result.matches = throughput(text.size(), [&]
+    {
+        std::cregex_iterator it(text.data(), text.data() + text.size(), pattern), end;
+        result.count = std::distance(it, end);
+    });
+    result.replace = throughput(text.size(), [&] { found += std::regex_replace(copy, pattern, "#").size(); });
+    return result;
+}
+
+void print(const Entry &entry, const Result &result, const Flags &flags)
+{
+    if (flags.csv)
+    {
+        std::printf("%s,%s,%s,%.1f,%zu,%zu,%.2f,%.2f,%.2f,%.2f,%zu\n", entry.name, entry.corpus, result.lib.c_str(),
+            result.compile_us, result.memory, result.input, result.match, result.search, result.matches, result.replace,
+            result.count);
+        return;
+    }
+
+    auto rate = [](double mbps)
+    {
+        char res[32];
+        std::snprintf(res, sizeof(res), std::isnan(mbps) ? "-" : mbps < 10 ? "%.3g" : "%.1f", mbps);
+        return std::string(res);
+    };
+    std::printf("%-13s %-13s %-13s %11.1f %10zu %9s %9s %9s %9s %8zu\n", entry.name, entry.corpus, result.lib.c_str(),
+        result.compile_us, result.memory, rate(result.match).c_str(), rate(result.search).c_str(),
+        rate(result.matches).c_str(), rate(result.replace).c_str(), result.count);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i)
+    {
+        for (auto flag = argv[i] + 1; *flag; ++flag)
+        {
+            switch (*flag)
+            {
+            case 'c': flags.csv = true; break;
+            case 'L': flags.engine = cre::Engine::LAZY_DFA; break;
+            case 'J': flags.engine = cre::Engine::JIT; break;
+            case 'N': flags.engine = cre::Engine::NFA; break;
+            case 'x': flags.std_regex = false; break;
+            case 's':
+            case 'r':
+                if (flag[1] || i + 1 == argc)
+                {
+                    usage();
+                }
+                (*flag == 's' ? flags.size : flags.std_size) = std::strtoul(argv[++i], nullptr, 10);
+                flag = argv[i] + std::strlen(argv[i]) - 1;
+                break;
+            default:
+                usage();
+            }
+        }
+    }
+    std::vector<std::string> names(argv + i, argv + argc);
+
+    std::mt19937 random(20240229);
+    std::vector<std::pair<std::string, std::string>> corpora;
+    corpora.emplace_back("logs", logs(flags.size, random));
+    corpora.emplace_back("html", html(flags.size, random));
+    corpora.emplace_back("random", bytes(flags.size, random));
+    corpora.emplace_back("pathological", pathological(flags.size, random));
+
+    if (flags.csv)
+    {
+        std::printf("pattern,corpus,lib,compile_us,memory_bytes,input_bytes,match_mbps,search_mbps,matches_mbps,replace_mbps,matches\n");
+    }
+    else
+    {
+        std::printf("%-13s %-13s %-13s %11s %10s %9s %9s %9s %9s %8s\n", "pattern", "corpus", "lib", "compile us",
+            "memory", "match", "search", "matches", "replace", "count");
+    }
+    for (auto &entry: CATALOG)
+    {
+        if (!names.empty() && std::find(names.begin(), names.end(), entry.name) == names.end())
+        {
+            continue;
+        }
+        std::string_view text;
+        for (auto &corpus: corpora)
+        {
+            if (corpus.first == entry.corpus)
+            {
+                text = corpus.second;
+            }
+        }
+
+        print(entry, bench_cre(entry, flags, text), flags);
+        if (flags.std_regex)
+        {
+            print(entry, bench_std(entry, head(text, flags.std_size)), flags);
+        }
+        std::fflush(stdout);
+    }
+    return 0;
+}
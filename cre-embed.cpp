@@ -0,0 +1,62 @@
+// cre-embed, compiles patterns at build time into a header of their saved images
+//
+//   g++ -std=c++17 -O2 -o cre-embed cre-embed.cpp
+//   cre-embed name pattern [name pattern...] > patterns.hpp
+//
+// every pattern becomes an array called name, aligned to four bytes so that
+// cre::embedded<name>() reads its tables in place from the program's read-only
+// data; the images are only valid for the version of cre.hpp that wrote them
+
+#include "cre.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+using cre::details::identifier;
+using cre::details::printable;
+
+void usage()
+{
+    std::fprintf(stderr, "usage: cre-embed name pattern [name pattern...]\n");
+    std::exit(2);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc % 2 == 0)
+    {
+        usage();
+    }
+
+    std::printf("// generated by cre-embed, do not edit\n\n#include \"cre.hpp\"\n");
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string name = argv[i], pattern = argv[i + 1];
+        if (!identifier(name))
+        {
+            std::fprintf(stderr, "cre-embed: %s: not an identifier\n", name.c_str());
+            return 2;
+        }
+
+        // a pattern whose dfa does not fit runs on the nfa engine, which has no image, nor
+        // has one whose search automata are determinized while scanning
+        auto image = cre::Pattern(pattern).save();
+        if (image.empty())
+        {
+            std::fprintf(stderr, "cre-embed: %s: the dfa of %s is too large to save\n", name.c_str(),
+                printable(pattern).c_str());
+            return 1;
+        }
+        std::printf("\n// %s\nalignas(4) inline constexpr unsigned char %s[] =\n{", printable(pattern).c_str(), name.c_str());
+        for (std::size_t j = 0; j < image.size(); ++j)
+        {
+            std::printf("%s0x%02x,", j % 16 ? " " : "\n    ", static_cast<unsigned char>(image[j]));
+        }
+        std::printf("\n};\n");
+    }
+    return 0;
+}
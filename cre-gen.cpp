@@ -0,0 +1,320 @@
+// cre-gen, compiles patterns into a standalone header of direct-coded matchers
+//
+//   g++ -std=c++17 -O2 -o cre-gen cre-gen.cpp
+//   cre-gen name pattern [name pattern...] > matchers.hpp
+//
+// every state of the minimized dfas of a pattern becomes a labeled block that
+// compares the next byte against the ranges leading out of it and jumps to the
+// target, the way re2c does; the header needs nothing but <cstddef>. for every
+// name it defines, with the semantics of cre::Pattern:
+//
+//   std::size_t name::longest(const char *data, std::size_t size, std::size_t at)
+//       the end of the longest match starting at at, or name::npos
+//   bool name::find(const char *data, std::size_t size, std::size_t from,
+//       std::size_t &begin, std::size_t &end)
+//       the leftmost-longest match starting at or after from, as [begin, end)
+//
+// with CRE_GEN_NO_MAIN defined it leaves main out, for the tests to call generate
+
+#include "cre.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace
+{
+using cre::details::DFA;
+using cre::details::identifier;
+using cre::details::printable;
+
+// a block with at most this many ranges leaving it compares them in turn,
+// one with more switches on the byte, which compilers lower to a jump table
+constexpr std::size_t MAX_COMPARES = 4;
+
+#ifndef CRE_GEN_NO_MAIN
+void usage()
+{
+    std::fprintf(stderr, "usage: cre-gen name pattern [name pattern...]\n");
+    std::exit(2);
+}
+#endif
+
+std::string byte(int c)
+{
+    char res[8];
+    std::snprintf(res, sizeof(res), "0x%02x", c);
+    return res;
+}
+
+// what a run of the blocks of a dfa does on entering a state, at the end of its
+// input and on reaching the dead state; the statements are inserted as they are
+class Actions
+{
+  public:
+    std::function<std::string(std::uint32_t)> enter, at_end;
+    std::string dead;
+};
+
+// the blocks of the states of dfa reachable from entries, labeled prefix and the
+// state id; p walks the input forwards to last, or backwards to first if reverse
+class Emitter
+{
+  private:
+    const DFA &dfa;
+    std::string prefix;
+    bool reverse;
+
+  public:
+    Emitter(const DFA &dfa, std::string prefix, bool reverse) : dfa(dfa), prefix(std::move(prefix)), reverse(reverse) {}
+
+    // a jump to state, or the dead action
+    std::string jump(std::uint32_t state, const Actions &actions) const
+    {
+        return state == DFA::DEAD ? actions.dead : "goto " + prefix + std::to_string(state) + ";";
+    }
+
+    // the live states reachable from entries, in the order they are first reached
+    std::vector<std::uint32_t> reachable(const std::vector<std::uint32_t> &entries) const
+    {
+        std::vector<bool> seen(dfa.accept.size());
+        std::vector<std::uint32_t> res;
+        auto visit = [&](std::uint32_t state)
+        {
+            if (state != DFA::DEAD && !seen[state])
+            {
+                seen[state] = true;
+                res.push_back(state);
+            }
+        };
+        for (auto state: entries)
+        {
+            visit(state);
+        }
+        for (std::size_t i = 0; i < res.size(); ++i)
+        {
+            for (int c = 0; c < 256; ++c)
+            {
+                visit(dfa.next(res[i], static_cast<unsigned char>(c)));
+            }
+        }
+        return res;
+    }
+
+    std::string emit(const std::vector<std::uint32_t> &entries, const Actions &actions) const
+    {
+        std::string res;
+        for (auto state: reachable(entries))
+        {
+            res += prefix + std::to_string(state) + ":\n";
+            res += actions.enter(state);
+            res += "    if (p == " + std::string(reverse ? "first" : "last") + ")\n    {\n";
+            res += "        " + actions.at_end(state) + "\n    }\n";
+            res += reverse ? "    c = *--p;\n" : "    c = *p++;\n";
+
+            // the maximal runs of bytes that lead to one live target
+            std::vector<std::tuple<int, int, std::uint32_t>> ranges;
+            for (int c = 0; c < 256; ++c)
+            {
+                auto next = dfa.next(state, static_cast<unsigned char>(c));
+                if (next == DFA::DEAD)
+                {
+                    continue;
+                }
+                if (!ranges.empty() && std::get<1>(ranges.back()) == c - 1 && std::get<2>(ranges.back()) == next)
+                {
+                    std::get<1>(ranges.back()) = c;
+                }
+                else
+                {
+                    ranges.emplace_back(c, c, next);
+                }
+            }
+
+            if (ranges.size() <= MAX_COMPARES)
+            {
+                for (auto &range: ranges)
+                {
+                    auto lo = std::get<0>(range), hi = std::get<1>(range);
+                    auto test = lo == hi ? "c == " + byte(lo)
+                        : lo == 0 ? "c <= " + byte(hi)
+                        : hi == 255 ? "c >= " + byte(lo)
+                        : "c >= " + byte(lo) + " && c <= " + byte(hi);
+                    res += "    if (" + test + ")\n    {\n        " + jump(std::get<2>(range), actions) + "\n    }\n";
+                }
+                res += "    " + actions.dead + "\n";
+            }
+            else
+            {
+                res += "    switch (c)\n    {\n";
+                for (auto &range: ranges)
+                {
+                    for (auto c = std::get<0>(range); c <= std::get<1>(range); ++c)
+                    {
+                        res += "    case " + byte(c) + ":\n";
+                    }
+                    res += "        " + jump(std::get<2>(range), actions) + "\n";
+                }
+                res += "    default:\n        " + actions.dead + "\n    }\n";
+            }
+        }
+        return res;
+    }
+};
+
+// the matchers of one pattern, built from the automata cre::Pattern searches with,
+// or nothing when one of those takes more than cre::Options::dfa_capacity to build
+std::optional<std::string> generate(const std::string &name, const std::string &pattern)
+{
+    cre::details::NFA nfa;
+    bool begin, end;
+    std::tie(nfa, begin, end) = cre::details::Parser().gen_nfa(reinterpret_cast<const unsigned char *>(pattern.c_str()));
+    auto words = nfa.nonempty();
+    auto capacity = cre::Options().dfa_capacity;
+    auto built = words.to_dfa(true, capacity);
+    if (!built)
+    {
+        return std::nullopt;
+    }
+    auto &forward = *built;
+
+    std::string res = "\n// " + printable(pattern) + "\nnamespace " + name + "\n{\n"
+        "inline constexpr std::size_t npos = -1;\n\n";
+    if (std::find(forward.accept.data(), forward.accept.data() + forward.accept.size(), true)
+        == forward.accept.data() + forward.accept.size())
+    {
+        // a pattern of no nonempty word never matches
+        return res + "inline std::size_t longest(const char *, std::size_t, std::size_t)\n{\n    return npos;\n}\n\n"
+            "inline bool find(const char *, std::size_t, std::size_t, std::size_t &, std::size_t &)\n{\n"
+            "    return false;\n}\n} // namespace " + name + "\n";
+    }
+
+    res += "inline std::size_t longest(const char *data, std::size_t size, std::size_t at)\n{\n"
+        "    auto base = reinterpret_cast<const unsigned char *>(data), last = base + size, p = base + at;\n"
+        + std::string(end ? "" : "    std::size_t res = npos;\n")
+        + "    unsigned char c;\n";
+
+    // the longest match ends at the last accepting state before the dead one,
+    // or with end set at the end of the input
+    Actions longest;
+    longest.enter = [&](std::uint32_t state)
+    {
+        return forward.accept[state] && !end ? "    res = p - base;\n" : std::string();
+    };
+    longest.at_end = [&](std::uint32_t state)
+    {
+        return forward.accept[state] ? std::string("return p - base;") : end ? "return npos;" : "return res;";
+    };
+    longest.dead = end ? "return npos;" : "return res;";
+    Emitter emitter(forward, "s", false);
+    res += "    " + emitter.jump(forward.start, longest) + "\n" + emitter.emit({forward.start}, longest) + "}\n\n";
+
+    res += "inline bool find(const char *data, std::size_t size, std::size_t from, std::size_t &begin, std::size_t &end)\n{\n";
+    if (begin)
+    {
+        return res + "    begin = 0;\n"
+            "    end = from || !size ? npos : longest(data, size, 0);\n"
+            "    return end != npos;\n}\n} // namespace " + name + "\n";
+    }
+
+    // the leftmost start is the last accepting state of a backward scan down to from
+    auto reversed = end ? words.reversed().to_dfa(true, capacity)
+        : words.reversed().unanchored(false).to_dfa(true, capacity);
+    if (!reversed)
+    {
+        return std::nullopt;
+    }
+    auto &reverse = *reversed;
+    Actions scan;
+    scan.enter = [&](std::uint32_t state)
+    {
+        return reverse.accept[state] ? "    begin = p - base;\n" : std::string();
+    };
+    scan.at_end = [](std::uint32_t) { return std::string("goto done;"); };
+    scan.dead = "goto done;";
+    Emitter backward(reverse, "r", true);
+    auto start_scan = "    begin = npos;\n    " + backward.jump(reverse.start, scan) + "\n"
+        + backward.emit({reverse.start}, scan) + "done:\n";
+
+    res += "    auto base = reinterpret_cast<const unsigned char *>(data), first = base + from, last = base + size, p = first;\n"
+        "    unsigned char c;\n";
+    if (end)
+    {
+        res += "    p = last;\n" + start_scan + "    end = size;\n    return begin != npos;\n}\n";
+        return res + "} // namespace " + name + "\n";
+    }
+
+    // the earliest end of any match, then on the stop symbol no new thread is
+    // started and the ones under way die out by hi, where the backward scan starts;
+    // it goes down to from, the minimized start state may stand for states with
+    // threads under way; the end is the one of the longest match from the start found
+    auto looping = words.unanchored().to_dfa(true, capacity);
+    if (!looping)
+    {
+        return std::nullopt;
+    }
+    auto &unanchored = *looping;
+
+    Actions dying;
+    dying.enter = [](std::uint32_t) { return std::string(); };
+    dying.at_end = [](std::uint32_t) { return std::string("goto hi;"); };
+    dying.dead = "goto hi;";
+    Emitter stopped(unanchored, "b", false);
+
+    Actions earliest;
+    earliest.enter = [&](std::uint32_t state)
+    {
+        return unanchored.accept[state] ? "    " + stopped.jump(unanchored.stop(state), dying) + "\n" : std::string();
+    };
+    earliest.at_end = [](std::uint32_t) { return std::string("return false;"); };
+    earliest.dead = "return false;";
+    Emitter scanner(unanchored, "a", false);
+    std::vector<std::uint32_t> stops;
+    for (auto state: scanner.reachable({unanchored.start}))
+    {
+        if (unanchored.accept[state])
+        {
+            stops.push_back(unanchored.stop(state));
+        }
+    }
+
+    res += "    " + scanner.jump(unanchored.start, earliest) + "\n" + scanner.emit({unanchored.start}, earliest)
+        + stopped.emit(stops, dying) + "hi:\n" + start_scan
+        + "    end = longest(data, size, begin);\n    return true;\n}\n";
+    return res + "} // namespace " + name + "\n";
+}
+} // namespace
+
+#ifndef CRE_GEN_NO_MAIN
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc % 2 == 0)
+    {
+        usage();
+    }
+
+    std::printf("// generated by cre-gen, do not edit\n\n#pragma once\n\n#include <cstddef>\n");
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string name = argv[i];
+        if (!identifier(name))
+        {
+            std::fprintf(stderr, "cre-gen: %s: not an identifier\n", name.c_str());
+            return 2;
+        }
+        auto matchers = generate(name, argv[i + 1]);
+        if (!matchers)
+        {
+            std::fprintf(stderr, "cre-gen: %s: the dfa of %s is too large\n", name.c_str(),
+                printable(argv[i + 1]).c_str());
+            return 1;
+        }
+        std::fputs(matchers->c_str(), stdout);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,187 @@
+// cre-grep, prints the lines of files that match a pattern, like grep
+//
+//   g++ -std=c++17 -O2 -o cre-grep cre-grep.cpp -pthread
+//   cre-grep [-bcoLJNt] [-j threads] pattern [file...]
+//
+// files are mapped into memory and scanned in place, with no file or "-" the
+// standard input is read; the time taken goes to stderr with -t, so the tool
+// doubles as an end to end throughput benchmark of the engine
+
+#include "cre.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+class Flags
+{
+  public:
+    bool offsets, count, only, lazy, jit, nfa, timing;
+    std::size_t threads;
+
+    Flags() : offsets(false), count(false), only(false), lazy(false), jit(false), nfa(false), timing(false), threads(1) {}
+};
+
+void usage()
+{
+    std::fprintf(stderr,
+        "usage: cre-grep [-bcoLJNt] [-j threads] pattern [file...]\n"
+        "  -b  print the byte offset of every match\n"
+        "  -c  print the number of matching lines only\n"
+        "  -o  print the matches only, not their lines\n"
+        "  -L  use the lazy dfa engine\n"
+        "  -J  use the jit engine\n"
+        "  -N  use the nfa engine\n"
+        "  -t  print the scan time, throughput and engine to stderr\n"
+        "  -j  scan with this many threads, 0 for one per core\n");
+    std::exit(2);
+}
+
+// the matching lines, or matches, of one file; returns the number of matching lines
+std::size_t grep(const cre::Pattern &pattern, const Flags &flags, std::string_view data, const std::string &prefix)
+{
+    std::vector<cre::Span> spans;
+    if (flags.threads == 1)
+    {
+        spans = pattern.matches_span(data);
+    }
+    else
+    {
+        cre::Parallel parallel;
+        parallel.threads = flags.threads;
+        spans = pattern.matches_span(data, parallel);
+    }
+
+    std::size_t lines = 0, printed = 0;
+    for (auto &span: spans)
+    {
+        auto end = span.offset + span.length;
+        auto begin = data.rfind('\n', span.offset ? span.offset - 1 : 0);
+        begin = span.offset && begin != std::string_view::npos ? begin + 1 : 0;
+        end = data.find('\n', end ? end - 1 : 0);
+        end = end == std::string_view::npos ? data.size() : end;
+
+        // a line with several matches counts and prints once
+        if (begin < printed && !flags.only && !flags.offsets)
+        {
+            continue;
+        }
+        if (begin >= printed)
+        {
+            ++lines;
+        }
+        printed = std::max(printed, end + 1);
+        if (flags.count)
+        {
+            continue;
+        }
+
+        std::fputs(prefix.c_str(), stdout);
+        if (flags.offsets)
+        {
+            std::printf("%zu:", span.offset);
+        }
+        auto text = flags.only ? span.of(data) : data.substr(begin, end - begin);
+        std::fwrite(text.data(), 1, text.size(), stdout);
+        std::fputc('\n', stdout);
+    }
+
+    if (flags.count)
+    {
+        std::printf("%s%zu\n", prefix.c_str(), lines);
+    }
+    return lines;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Flags flags;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i)
+    {
+        if (std::string(argv[i]) == "--")
+        {
+            ++i;
+            break;
+        }
+        for (auto flag = argv[i] + 1; *flag; ++flag)
+        {
+            switch (*flag)
+            {
+            case 'b': flags.offsets = true; break;
+            case 'c': flags.count = true; break;
+            case 'o': flags.only = true; break;
+            case 'L': flags.lazy = true; break;
+            case 'J': flags.jit = true; break;
+            case 'N': flags.nfa = true; break;
+            case 't': flags.timing = true; break;
+            case 'j':
+                if (flag[1] || i + 1 == argc)
+                {
+                    usage();
+                }
+                flags.threads = std::strtoul(argv[++i], nullptr, 10);
+                flag = argv[i] + std::strlen(argv[i]) - 1;
+                break;
+            default:
+                usage();
+            }
+        }
+    }
+    if (i == argc)
+    {
+        usage();
+    }
+
+    cre::Options options;
+    if (flags.lazy)
+    {
+        options.engine = cre::Engine::LAZY_DFA;
+    }
+    else if (flags.jit)
+    {
+        options.engine = cre::Engine::JIT;
+    }
+    else if (flags.nfa)
+    {
+        options.engine = cre::Engine::NFA;
+    }
+    cre::Pattern pattern(argv[i++], options);
+
+    std::vector<std::string> paths(argv + i, argv + argc);
+    if (paths.empty())
+    {
+        paths.push_back("-");
+    }
+
+    std::size_t lines = 0, bytes = 0;
+    int status = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &path: paths)
+    {
+        cre::File file(path);
+        if (!file)
+        {
+            std::fprintf(stderr, "cre-grep: %s: cannot read\n", path.c_str());
+            status = 2;
+            continue;
+        }
+        bytes += file.view().size();
+        lines += grep(pattern, flags, file.view(), paths.size() > 1 ? path + ":" : std::string());
+    }
+    std::fflush(stdout);
+
+    if (flags.timing)
+    {
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        const char *engines[] = {"dfa", "lazy dfa", "jit", "nfa"};
+        std::fprintf(stderr, "%zu bytes in %.3f s, %.1f MB/s, %s engine\n", bytes, seconds.count(),
+            bytes / seconds.count() / 1e6, engines[static_cast<int>(pattern.engine())]);
+    }
+    return status ? status : lines ? 0 : 1;
+}
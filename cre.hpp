@@ -3,17 +3,117 @@
 
 #include <set>
 #include <map>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include <tuple>
+#include <array>
+#include <cassert>
 #include <cctype>
+#include <climits>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <optional>
+#include <unordered_map>
 #include <bitset>
+#include <cstdint>
 #include <algorithm>
 #include <functional>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CRE_SSSE3
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CRE_MMAP
+#endif
+
+#if defined(CRE_MMAP) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define CRE_JIT
+#endif
 
 namespace cre
 {
+enum class Engine
+{
+    // determinize the whole automaton when the pattern is compiled
+    DFA,
+    // determinize while scanning, caching only the states the input reaches
+    LAZY_DFA,
+    // the dfa translated to x86-64 machine code, the dfa engine where that is
+    // not supported or the dfa is too large
+    JIT,
+    // simulate the nfa without determinizing it, a repetition of one set of bytes
+    // such as [0-9a-f]{64} is a single counting state however large its bounds
+    NFA
+};
+
+class Options
+{
+  public:
+    Engine engine;
+    // run dfa minimization after subset construction,
+    // turn it off when compile latency matters more than table size
+    bool minimize;
+    // memory cap in bytes of the lazy dfa's state cache, it is flushed when full
+    std::size_t cache_capacity;
+    // memory cap in bytes of determinizing a pattern for the dfa and jit engines, the
+    // nfa and all the automata built from it counted, 0 for none; one that takes more
+    // runs on the nfa engine, as Pattern::engine tells
+    std::size_t dfa_capacity;
+
+    Options() : engine(Engine::DFA), minimize(true), cache_capacity(1 << 21), dfa_capacity(1 << 26) {}
+};
+
+// how a scan of one large input is split across threads
+class Parallel
+{
+  public:
+    // 0 for one per hardware thread
+    std::size_t threads;
+    // bytes of input per task, an input of one chunk is scanned serially
+    std::size_t chunk_size;
+
+    Parallel() : threads(0), chunk_size(1 << 20) {}
+};
+
+// what compiling a pattern took, phase by phase; the dfa counts and times add up
+// the automata the engine determinized, the forward, unanchored and reverse ones
+class Stats
+{
+  public:
+    // nodes of the syntax tree, a named subexpression counted at every reference
+    std::size_t nodes;
+    // states of the nfa the engine runs on, repetitions written out but for the nfa engine
+    std::size_t nfa_states;
+    // dfa states after the subset construction and after minimization, the dead one included
+    std::size_t subset_states, dfa_states;
+    // byte classes of the forward automaton
+    std::size_t byte_classes;
+    // time spent in each phase, minimize_time only when Options::minimize is set
+    std::chrono::nanoseconds parse_time, nfa_time, subset_time, minimize_time;
+    // bytes the compiled pattern holds: tables, nfa, prefilter and machine code,
+    // not the states a lazy dfa engine fills its caches with while scanning
+    std::size_t bytes;
+
+    Stats() : nodes(0), nfa_states(0), subset_states(0), dfa_states(0), byte_classes(0),
+        parse_time(0), nfa_time(0), subset_time(0), minimize_time(0), bytes(0) {}
+};
+
 namespace details
 {
 inline const std::bitset<256> SPACES(0X100003e00ULL);
@@ -43,14 +143,44 @@ class NFAState
     {
         EPSILON,
         CCL,
+        // input_set repeated as often as the bounds NFA::repeats[repeat] allow
+        // before next, only Simulation and Captures run it, the others take NFA::unrolled
+        COUNT,
         EMPTY
     };
 
+    static constexpr std::uint32_t NONE = UINT32_MAX;
+
     EdgeType edge_type;
-    std::bitset<256> input_set;
-    std::shared_ptr<NFAState> next, next2;
+    // id of the input set in NFA::sets, only used by CCL states
+    std::uint32_t input_set;
+    std::uint32_t next, next2;
+    // the capture slot passing through the state records the position in, or NONE,
+    // only Captures looks at it, to the automata the state is like any other
+    std::uint32_t save;
+    // id of the bounds in NFA::repeats, only used by COUNT states
+    std::uint32_t repeat;
+
+    NFAState() : edge_type(EdgeType::EMPTY), input_set(0), next(NONE), next2(NONE), save(NONE), repeat(0) {}
+};
+
+// the bounds of a COUNT state, max is UNBOUNDED for {n,}
+class Repeat
+{
+  public:
+    static constexpr std::uint32_t UNBOUNDED = UINT32_MAX;
+
+    std::uint32_t min, max;
+
+    Repeat(std::uint32_t min, std::uint32_t max) : min(min), max(max) {}
+};
+
+class NFAPair
+{
+  public:
+    std::uint32_t start, end;
 
-    NFAState() : next(nullptr), next2(nullptr) {}
+    NFAPair(std::uint32_t start, std::uint32_t end) : start(start), end(end) {}
 };
 
 class DFAState
@@ -62,963 +192,5729 @@ class DFAState
         END
     } state_type;
 
-    std::map<unsigned char, std::shared_ptr<DFAState>> to;
+    // target per byte class, -1 when there is no edge
+    std::vector<int> to;
+    // id of the set of patterns a state of a tagged union accepts, 0 for none
+    std::uint32_t tag;
 
-    DFAState() : state_type(State::NORMAL) {}
-    DFAState(State type) : state_type(type) {}
+    DFAState(State type, std::size_t nclasses, std::uint32_t tag = 0)
+      : state_type(type), to(nclasses, -1), tag(tag) {}
 };
 
-class NFAPair
+// partition of 0-255 into classes of bytes no input set tells apart
+class ByteClasses
 {
-  private:
-    void add2rS(std::set<std::shared_ptr<NFAState>> &rS,
-        std::shared_ptr<NFAState> s)
+  public:
+    std::array<unsigned char, 256> map;
+    std::vector<unsigned char> reps;
+
+    ByteClasses() : reps(1, 0)
+    {
+        map.fill(0);
+    }
+
+    ByteClasses(const std::vector<std::bitset<256>> &sets)
     {
-        rS.insert(s);
-        if (s->edge_type == NFAState::EdgeType::EPSILON)
+        map.fill(0);
+        int count = 1;
+        for (auto &set: sets)
         {
-            if (!rS.count(s->next))
-            {
-                add2rS(rS, s->next);
-            }
-            if (s->next2 && !rS.count(s->next2))
+            // split every class into the bytes inside and outside of set
+            std::map<std::pair<int, bool>, int> ids;
+            for (int c = 0; c < 256; ++c)
             {
-                add2rS(rS, s->next2);
+                auto key = std::make_pair(static_cast<int>(map[c]), static_cast<bool>(set[c]));
+                auto it = ids.find(key);
+                if (it == ids.end())
+                {
+                    it = ids.emplace(key, static_cast<int>(ids.size())).first;
+                }
+                map[c] = static_cast<unsigned char>(it->second);
             }
+            count = static_cast<int>(ids.size());
         }
-    }
 
-    std::set<std::shared_ptr<NFAState>>
-    eps_closure(const std::set<std::shared_ptr<NFAState>> &S)
-    {
-        std::set<std::shared_ptr<NFAState>> rS;
-        for (auto &s: S)
+        reps.assign(count, 0);
+        for (int c = 255; c >= 0; --c)
         {
-            add2rS(rS, s);
+            reps[map[c]] = static_cast<unsigned char>(c);
         }
-        return rS;
     }
 
-    std::set<std::shared_ptr<NFAState>>
-    delta(const std::set<std::shared_ptr<NFAState>> &q, unsigned char c)
+    std::size_t size() const
     {
-        std::set<std::shared_ptr<NFAState>> rq;
-        for (auto &s: q)
-        {
-            if (s->edge_type == NFAState::EdgeType::CCL && s->input_set[c])
-            {
-                rq.insert(s->next);
-            }
-        }
-        return rq;
+        return reps.size();
     }
 
-    int indexof_inmp(std::vector<std::shared_ptr<DFAState>> &mp,
-        std::shared_ptr<DFAState> state)
+    // the classes of a saved map, see DFA::save
+    static bool load(const unsigned char *map, ByteClasses &classes)
     {
-        for (int i = 0; i < (int)mp.size(); ++i)
+        std::size_t count = 1 + *std::max_element(map, map + 256);
+        classes.reps.assign(count, 0);
+        std::vector<bool> seen(count);
+        for (int c = 255; c >= 0; --c)
         {
-            if (mp[i] == state)
-            {
-                return i;
-            }
+            classes.map[c] = map[c];
+            classes.reps[map[c]] = static_cast<unsigned char>(c);
+            seen[map[c]] = true;
         }
-        return -1;
+        return std::find(seen.begin(), seen.end(), false) == seen.end();
     }
+};
 
-    std::vector<std::set<int>>
-    split(std::vector<std::shared_ptr<DFAState>> &mp,
-        std::set<std::set<int>> &P,
-        const std::set<int> &S)
+// the bytes of set for a label of a graph in the dot language, complemented
+// behind ^ when that is shorter
+inline std::string dot_bytes(const std::bitset<256> &set)
+{
+    auto byte = [](int c)
     {
-        std::vector<std::set<int>> res = {S};
-
-        for (int _c = 0; _c < 256; ++_c)
+        if (c == '"' || c == '\\')
         {
-            unsigned char c = static_cast<unsigned char>(_c);
-            std::set<int> s1, s2;
-
-            auto flag_it = P.end();
-
-            for (auto i: S)
+            return std::string("\\") + static_cast<char>(c);
+        }
+        if (std::isgraph(c))
+        {
+            return std::string(1, static_cast<char>(c));
+        }
+        char res[8];
+        std::snprintf(res, sizeof(res), "\\\\x%02x", c);
+        return std::string(res);
+    };
+    auto ranges = [&](const std::bitset<256> &set)
+    {
+        std::string res;
+        for (int c = 0; c < 256; ++c)
+        {
+            if (!set[c])
             {
-                if (mp[i]->to.count(c))
-                {
-                    int k = indexof_inmp(mp, mp[i]->to[c]);
-                    for (auto it = P.begin(); it != P.end(); ++it)
-                    {
-                        if (it->count(k))
-                        {
-                            if (it == flag_it)
-                            {
-                                s1.insert(i);
-                            }
-                            else if (flag_it == P.end())
-                            {
-                                flag_it = it;
-                                s1.insert(i);
-                            }
-                            else
-                            {
-                                s2.insert(i);
-                            }
-                            break;
-                        }
-                    }
-                }
-                else
-                {
-                    s2.insert(i);
-                }
+                continue;
             }
-
-            if (s1.size() && s2.size())
+            auto hi = c;
+            while (hi < 255 && set[hi + 1])
             {
-                res = {s1, s2};
-                return res;
+                ++hi;
             }
+            res += byte(c) + (hi > c + 1 ? "-" : "") + (hi > c ? byte(hi) : "");
+            c = hi;
         }
         return res;
+    };
+    if (set.all())
+    {
+        return "any";
     }
+    return set.count() > 128 ? "^" + ranges(~set) : ranges(set);
+}
 
-    int indexof_inp(std::vector<std::shared_ptr<DFAState>> &mp,
-        std::vector<std::set<int>> &P,
-        std::shared_ptr<DFAState> state)
+// whether name may name a variable in the code cre-gen and cre-embed write
+inline bool identifier(const std::string &name)
+{
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+    {
+        return false;
+    }
+    for (unsigned char c: name)
     {
-        for (int i = 0, k = indexof_inmp(mp, state); i < (int)P.size(); ++i)
+        if (!std::isalnum(c) && c != '_')
         {
-            if (P[i].count(k))
-            {
-                return i;
-            }
+            return false;
         }
-        return -1;
     }
+    return true;
+}
 
-    std::shared_ptr<DFAState>
-    dfa_minimization(std::vector<std::shared_ptr<DFAState>> &mp)
+// the pattern as it may go into a line comment, which a last backslash would
+// splice with the next line
+inline std::string printable(const std::string &pattern)
+{
+    std::string res;
+    for (std::size_t i = 0; i < pattern.size(); ++i)
     {
-        std::set<std::set<int>> T, P;
-
+        auto c = static_cast<unsigned char>(pattern[i]);
+        if (std::isprint(c) && !(c == '\\' && i + 1 == pattern.size()))
         {
-            std::vector<std::set<int>> _T = {{}, {}};
-            for (int i = 0; i < (int)mp.size(); ++i)
-            {
-                _T[mp[i]->state_type == DFAState::State::END].insert(i);
-            }
-            T.insert(_T[0]); T.insert(_T[1]);
+            res += static_cast<char>(c);
         }
-
-        while (P != T)
+        else
         {
-            P = T; T.clear();
-            for (auto &p: P)
-            {
-                for (auto &_p: split(mp, P, p))
-                {
-                    T.insert(_p);
-                }
-            }
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\x%02x", c);
+            res += escape;
         }
+    }
+    return res;
+}
 
-        std::vector<std::shared_ptr<DFAState>> states;
-        for (std::size_t i = 0; i < T.size(); ++i)
-        {
-            states.push_back(std::make_shared<DFAState>());
-        }
-        std::shared_ptr<DFAState> start = nullptr;
+inline bool little_endian()
+{
+    const std::uint32_t one = 1;
+    return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
 
-        {
-            std::vector<std::set<int>> P(T.begin(), T.end());
+// a run of T in a vector of its own, or in memory kept alive by someone else,
+// such as a mapped pattern image, which is then only read
+template <typename T>
+class Slice
+{
+  private:
+    std::vector<T> own;
+    const T *base;
+    std::size_t count;
 
-            for (int i = 0; i < (int)P.size(); ++i)
-            {
-                for (auto &k: P[i])
-                {
-                    if (mp[k]->state_type == DFAState::State::END)
-                    {
-                        states[i]->state_type = DFAState::State::END;
-                    }
-                    if (k == 0)
-                    {
-                        start = states[i];
-                    }
-                    for (auto it: mp[k]->to)
-                    {
-                        states[i]->to[it.first] = states[indexof_inp(mp, P, it.second)];
-                    }
-                }
-            }
-        }
-        return start;
+  public:
+    Slice() : base(nullptr), count(0) {}
+    Slice(std::size_t count, T value) : own(count, value), base(own.data()), count(count) {}
+    Slice(const T *base, std::size_t count) : base(base), count(count) {}
+    Slice(std::vector<T> own) : own(std::move(own)), base(this->own.data()), count(this->own.size()) {}
+
+    Slice(const Slice &other) : own(other.own), base(own.empty() ? other.base : own.data()), count(other.count) {}
+    Slice(Slice &&) = default;
+    Slice &operator=(Slice &&) = default;
+
+    Slice &operator=(const Slice &other)
+    {
+        own = other.own;
+        base = own.empty() ? other.base : own.data();
+        count = other.count;
+        return *this;
     }
 
-  public:
-    std::shared_ptr<NFAState> start, end;
+    const T &operator[](std::size_t i) const
+    {
+        return base[i];
+    }
 
-    NFAPair() : start(std::make_shared<NFAState>()), end(std::make_shared<NFAState>()) {}
-    NFAPair(std::shared_ptr<NFAState> start, std::shared_ptr<NFAState> end) : start(start), end(end) {}
+    // writes go to a slice of its own only
+    T &operator[](std::size_t i)
+    {
+        return own[i];
+    }
 
-    std::shared_ptr<DFAState> to_dfa()
+    void resize(std::size_t size, T value)
     {
-        auto q0 = eps_closure({start});
-        std::vector<std::set<std::shared_ptr<NFAState>>> Q = {q0}, work_list = {q0};
-        std::vector<std::shared_ptr<DFAState>> mp = {
-            std::make_shared<DFAState>((std::find(q0.begin(), q0.end(), end) != q0.end())
-                ? DFAState::State::END
-                : DFAState::State::NORMAL)
-        };
+        own.resize(size, value);
+        base = own.data();
+        count = size;
+    }
 
-        while (work_list.size())
-        {
-            auto q = work_list.back();
-            work_list.pop_back();
-            for (int _c = 0; _c < 256; ++_c)
-            {
-                unsigned char c = static_cast<unsigned char>(_c);
-                auto t = eps_closure(delta(q, c));
-                if (t.empty())
-                {
-                    continue;
-                }
-                for (int i = 0, j = -1; i < (int)Q.size() && j == -1; ++i)
-                {
-                    if (Q[i] == q)
-                    {
-                        while (++j < (int)Q.size())
-                        {
-                            if (Q[j] == t && (mp[i]->to[c] = mp[j]) == mp[j])
-                            {
-                                break;
-                            }
-                        }
+    void push_back(T value)
+    {
+        resize(count + 1, value);
+    }
 
-                        if (j == (int)Q.size())
-                        {
-                            Q.push_back(t);
-                            work_list.push_back(t);
-                            mp.push_back(std::make_shared<DFAState>((std::find(t.begin(), t.end(), end) != t.end())
-                                ? DFAState::State::END
-                                : DFAState::State::NORMAL
-                            ));
-                            mp[i]->to[c] = mp.back();
-                        }
-                    }
-                }
-            }
-        }
+    const T *data() const
+    {
+        return base;
+    }
 
-        return dfa_minimization(mp);
+    std::size_t size() const
+    {
+        return count;
     }
 };
 
-class Node
+// appends the image of a compiled pattern, every number is little-endian and
+// every array starts at a multiple of four bytes, see Reader
+class Writer
 {
   public:
-    virtual ~Node() {}
-    virtual std::shared_ptr<NFAPair> compile() = 0;
-};
-
-class LeafNode : public Node
-{
-  private:
-    unsigned char leaf;
+    std::string out;
 
-  public:
-    LeafNode(unsigned char c) : leaf(c) {}
-    virtual std::shared_ptr<NFAPair> compile()
+    void u32(std::uint32_t value)
     {
-        auto ptr = std::make_shared<NFAPair>();
+        for (int i = 0; i < 4; ++i)
+        {
+            out += static_cast<char>(value >> (8 * i));
+        }
+    }
 
-        ptr->start->edge_type = NFAState::EdgeType::CCL;
-        ptr->end->edge_type = NFAState::EdgeType::EMPTY;
-        ptr->start->next = ptr->end;
-        ptr->start->input_set.set(leaf);
+    void bytes(const void *data, std::size_t size)
+    {
+        out.append(static_cast<const char *>(data), size);
+        out.append((4 - size % 4) % 4, '\0');
+    }
 
-        return ptr;
+    void u32s(const std::uint32_t *data, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            u32(data[i]);
+        }
     }
 };
 
-class CatNode : public Node
+// reads an image written by Writer; when it may borrow from the image, on a
+// little-endian host with the image aligned, the arrays are used where they are,
+// otherwise they are decoded into copies
+class Reader
 {
   private:
-    std::shared_ptr<Node> left, right;
+    const unsigned char *data;
+    std::size_t size, at;
+    bool in_place;
 
   public:
-    CatNode(std::shared_ptr<Node> left, std::shared_ptr<Node> right) : left(left), right(right) {}
-    virtual std::shared_ptr<NFAPair> compile()
-    {
-        auto left = this->left->compile();
-        auto right = this->right->compile();
-        auto ptr = std::make_shared<NFAPair>(left->start, right->end);
+    bool ok;
 
-        left->end->edge_type = NFAState::EdgeType::EPSILON;
-        left->end->next = right->start;
+    Reader(const void *data, std::size_t size, bool borrow)
+      : data(static_cast<const unsigned char *>(data)), size(size), at(0),
+        in_place(borrow && little_endian() && reinterpret_cast<std::uintptr_t>(data) % alignof(std::uint32_t) == 0),
+        ok(true) {}
 
-        return ptr;
+    // count bytes, or null once the image is too short
+    const unsigned char *bytes(std::size_t count)
+    {
+        auto padded = count + (4 - count % 4) % 4;
+        if (!ok || padded < count || padded > size - at)
+        {
+            ok = false;
+            return nullptr;
+        }
+        auto res = data + at;
+        at += padded;
+        return res;
     }
-};
-
-class SelectNode : public Node
-{
-  private:
-    std::shared_ptr<Node> left, right;
 
-  public:
-    SelectNode(std::shared_ptr<Node> left, std::shared_ptr<Node> right) : left(left), right(right) {}
-    virtual std::shared_ptr<NFAPair> compile()
+    std::uint32_t u32()
     {
-        auto left = this->left->compile();
-        auto right = this->right->compile();
-        auto ptr = std::make_shared<NFAPair>();
+        auto p = bytes(4);
+        return p ? p[0] | p[1] << 8 | p[2] << 16 | static_cast<std::uint32_t>(p[3]) << 24 : 0;
+    }
 
-        ptr->start->edge_type = NFAState::EdgeType::EPSILON;
-        ptr->end->edge_type = NFAState::EdgeType::EMPTY;
-        ptr->start->next = left->start;
-        ptr->start->next2 = right->start;
+    Slice<std::uint32_t> u32s(std::size_t count)
+    {
+        auto p = count <= SIZE_MAX / 4 ? bytes(count * 4) : (ok = false, nullptr);
+        if (!p)
+        {
+            return Slice<std::uint32_t>();
+        }
+        if (in_place)
+        {
+            return Slice<std::uint32_t>(reinterpret_cast<const std::uint32_t *>(p), count);
+        }
+        std::vector<std::uint32_t> res(count);
+        for (std::size_t i = 0; i < count; ++i, p += 4)
+        {
+            res[i] = p[0] | p[1] << 8 | p[2] << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+        }
+        return Slice<std::uint32_t>(std::move(res));
+    }
 
-        left->end->edge_type = NFAState::EdgeType::EPSILON;
-        right->end->edge_type = NFAState::EdgeType::EPSILON;
-        left->end->next = ptr->end;
-        right->end->next = ptr->end;
+    Slice<unsigned char> u8s(std::size_t count)
+    {
+        auto p = bytes(count);
+        if (!p)
+        {
+            return Slice<unsigned char>();
+        }
+        if (in_place)
+        {
+            return Slice<unsigned char>(p, count);
+        }
+        return Slice<unsigned char>(std::vector<unsigned char>(p, p + count));
+    }
 
-        return ptr;
+    bool done() const
+    {
+        return ok && at == size;
     }
 };
 
-class ClosureNode : public Node
+// flat transition table lowered from the minimized dfa, indexed by state and byte class,
+// state 0 is the dead state and every missing edge leads to it. the table of an
+// unanchored dfa has one more column, the stop symbol, see NFA::loop
+class DFA
 {
-  private:
-    std::shared_ptr<Node> content;
-
   public:
-    ClosureNode(std::shared_ptr<Node> content) : content(content) {}
-    virtual std::shared_ptr<NFAPair> compile()
-    {
-        auto content = this->content->compile();
-        auto ptr = std::make_shared<NFAPair>();
+    static constexpr std::uint32_t DEAD = 0;
 
-        ptr->start->edge_type = NFAState::EdgeType::EPSILON;
-        ptr->start->next = content->start;
-        ptr->start->next2 = ptr->end;
-        ptr->end->edge_type = NFAState::EdgeType::EMPTY;
+    ByteClasses classes;
+    std::size_t stride;
+    Slice<std::uint32_t> table;
+    Slice<unsigned char> accept;
+    // per state the id of the pattern set it accepts, as listed in tag_sets
+    Slice<std::uint32_t> tag;
+    std::vector<std::vector<std::uint32_t>> tag_sets;
+    std::uint32_t start;
 
-        content->end->edge_type = NFAState::EdgeType::EPSILON;
-        content->end->next = content->start;
-        content->end->next2 = ptr->end;
+    DFA() : DFA(ByteClasses(), 1) {}
+    DFA(const ByteClasses &classes, std::size_t stride)
+      : classes(classes), stride(stride), table(stride, DEAD), accept(1, false),
+        tag(1, 0), tag_sets(1), start(DEAD) {}
 
-        return ptr;
+    std::uint32_t add_state(bool is_end, std::uint32_t tag_id = 0)
+    {
+        table.resize(table.size() + stride, DEAD);
+        accept.push_back(is_end);
+        tag.push_back(tag_id);
+        return static_cast<std::uint32_t>(accept.size() - 1);
     }
-};
 
-class QualifierNode : public Node
-{
-  private:
-    std::shared_ptr<Node> content;
-    int n, m;
+    // the image of a dfa with no tags, loaded back by load
+    void save(Writer &out) const
+    {
+        out.u32(static_cast<std::uint32_t>(stride));
+        out.u32(static_cast<std::uint32_t>(accept.size()));
+        out.u32(start);
+        out.bytes(classes.map.data(), classes.map.size());
+        out.u32s(table.data(), table.size());
+        out.bytes(accept.data(), accept.size());
+    }
 
-  public:
-    QualifierNode(std::shared_ptr<Node> content, int n, int m) : content(content), n(n), m(m) {}
-    virtual std::shared_ptr<NFAPair> compile()
+    // the tables are used in place of the image where the reader allows, every
+    // edge is checked to stay inside of them
+    bool load(Reader &in)
     {
-        std::shared_ptr<NFAPair> ptr = std::make_shared<NFAPair>();
-        ptr->end->edge_type = NFAState::EdgeType::EMPTY;
+        stride = in.u32();
+        std::size_t count = in.u32();
+        start = in.u32();
+        auto map = in.bytes(256);
+        if (!in.ok || !map || !ByteClasses::load(map, classes) || !count || start >= count
+            || stride < classes.size() || stride > classes.size() + 1 || count > SIZE_MAX / stride)
+        {
+            return false;
+        }
 
-        // -2 means '{n}', -1 means '{n,}', >=0 means '{n,m}'
-        if (m == -2) // for '{n}'
+        table = in.u32s(count * stride);
+        accept = in.u8s(count);
+        if (!in.ok)
         {
-            std::shared_ptr<Node> temp = (n > 0) ? content : nullptr;
-            for (int i = 1; i < n; ++i)
-            {
-                temp = std::make_shared<CatNode>(temp, content);
-            }
-            if (temp)
-            {
-                return temp->compile();
-            }
-            else
-            {
-                ptr->start->edge_type = NFAState::EdgeType::EPSILON;
-                ptr->start->next = ptr->end;
-            }
+            return false;
         }
-        else if (m == -1) // for '{n,}'
+        tag = Slice<std::uint32_t>(count, 0);
+        auto edges = table.data();
+        for (std::size_t i = 0; i < table.size(); ++i)
         {
-            std::shared_ptr<Node> temp = (n > 0) ? content : nullptr;
-            for (int i = 1; i < n; ++i)
+            if (edges[i] >= count)
             {
-                temp = std::make_shared<CatNode>(temp, content);
+                return false;
             }
-            return temp
-                ? std::make_shared<CatNode>(temp, std::make_shared<ClosureNode>(content))->compile()
-                : std::make_shared<ClosureNode>(content)->compile();
         }
-        else if (n < m && n >= 0) // for '{n,m}'
+        return true;
+    }
+
+    std::uint32_t next(std::uint32_t state, unsigned char c) const
+    {
+        return table[state * stride + classes.map[c]];
+    }
+
+    std::uint32_t stop(std::uint32_t state) const
+    {
+        return table[state * stride + stride - 1];
+    }
+
+    // the bytes of the tables, whether they are its own or read in place
+    std::size_t bytes() const
+    {
+        std::size_t res = classes.reps.size() + table.size() * sizeof(std::uint32_t) + accept.size()
+            + tag.size() * sizeof(std::uint32_t);
+        for (auto &tags: tag_sets)
         {
-            auto first = content->compile();
-            auto pre = first;
-            ptr->start->edge_type = NFAState::EdgeType::EPSILON;
-            ptr->start->next = first->start;
-            if (n == 0)
+            res += tags.size() * sizeof(std::uint32_t);
+        }
+        return res;
+    }
+
+    // the dfa as a graph in the dot language of graphviz, without the dead
+    // state and the stop symbol
+    std::string dot() const
+    {
+        std::string res = "digraph dfa {\n    rankdir=LR;\n    node [shape=circle];\n"
+            "    entry [shape=point];\n    entry -> " + std::to_string(start) + ";\n";
+        for (std::uint32_t state = 1; state < accept.size(); ++state)
+        {
+            if (accept[state])
             {
-                ptr->start->next2 = ptr->end;
+                res += "    " + std::to_string(state) + " [shape=doublecircle];\n";
             }
-
-            for (int i = 1; i < m; ++i)
+            std::map<std::uint32_t, std::bitset<256>> edges;
+            for (int c = 0; c < 256; ++c)
             {
-                auto now = content->compile();
-                pre->end->edge_type = NFAState::EdgeType::EPSILON;
-                pre->end->next = now->start;
-                if (i > n - 2)
+                auto target = next(state, static_cast<unsigned char>(c));
+                if (target != DEAD)
                 {
-                    pre->end->next2 = ptr->end;
+                    edges[target].set(c);
                 }
-                pre = now;
             }
-
-            pre->end->edge_type = NFAState::EdgeType::EPSILON;
-            pre->end->next = ptr->end;
-        }
-        else
-        {
-            ptr->start->edge_type = NFAState::EdgeType::EPSILON;
-            ptr->start->next = ptr->end;
+            for (auto &edge: edges)
+            {
+                res += "    " + std::to_string(state) + " -> " + std::to_string(edge.first)
+                    + " [label=\"" + dot_bytes(edge.second) + "\"];\n";
+            }
         }
-
-        return ptr;
+        return res + "}\n";
     }
-};
 
-class BracketNode : public Node
-{
-  private:
-    std::bitset<256> chrs;
+    // a dfa is complete once built, matching it needs no cache
+    class Cache {};
 
-  public:
-    BracketNode(std::bitset<256> chrs) : chrs(chrs) {}
-    virtual std::shared_ptr<NFAPair> compile()
+    const DFA &bind(Cache &) const
     {
-        auto ptr = std::make_shared<NFAPair>();
+        return *this;
+    }
 
-        ptr->start->edge_type = NFAState::EdgeType::CCL;
-        ptr->end->edge_type = NFAState::EdgeType::EMPTY;
-        ptr->start->next = ptr->end;
-        ptr->start->input_set = chrs;
+    // nor is it ever flushed, see LazyDFA::Scan::revive
+    std::size_t flushes() const
+    {
+        return 0;
+    }
 
-        return ptr;
+    std::uint32_t revive(std::uint32_t state) const
+    {
+        return state;
     }
 };
 
-class Parser
+// the nfa of states as a graph in the dot language of graphviz, epsilon edges dashed
+inline std::string nfa_dot(const std::vector<NFAState> &states, const std::vector<std::bitset<256>> &sets,
+    const std::vector<Repeat> &repeats, std::uint32_t start, std::uint32_t end)
 {
-  private:
-    bool begin, end;
-    std::map<std::string, std::shared_ptr<Node>> ref_map;
-
-    unsigned char
-    translate_escape_chr(const unsigned char *&reading)
+    std::string res = "digraph nfa {\n    rankdir=LR;\n    node [shape=circle];\n"
+        "    entry [shape=point];\n    entry -> " + std::to_string(start) + ";\n"
+        "    " + std::to_string(end) + " [shape=doublecircle];\n";
+    for (std::uint32_t i = 0; i < states.size(); ++i)
     {
-        ++reading;
-        if (*reading)
+        auto &s = states[i];
+        auto edge = "    " + std::to_string(i) + " -> ";
+        if (s.edge_type == NFAState::EdgeType::EPSILON)
         {
-            switch (*reading)
+            for (auto next: {s.next, s.next2})
             {
-            case '0':
-                return '\0';
-            case 'a':
-                return '\a';
-            case 'b':
-                return '\b';
-            case 't':
-                return '\t';
-            case 'n':
-                return '\n';
-            case 'v':
-                return '\v';
-            case 'f':
-                return '\f';
-            case 'r':
-                return '\r';
-            case 'e':
-                return '\e';
-            case 'c':
-                if (*(reading+1) && (isalpha(*(reading+1)) || (*(reading + 1) > 63 && *(reading + 1) < 94)))
+                if (next != NFAState::NONE)
                 {
-                    ++reading;
-                    return toupper(*reading) - 64;
-                }
-                else
-                {
-                    return 'c';
+                    res += edge + std::to_string(next) + " [style=dashed];\n";
                 }
-            default:
-                return *reading;
             }
         }
-        else return 255;
-    }
-
-    std::bitset<256>
-    translate_echr2bset(unsigned char &left,
-        const unsigned char *&reading,
-        bool range)
-    {
-        auto res = translate_escape_chr(reading);
-        std::bitset<256> ret;
-        if (details::ECMAP.count(res))
-        {
-            ret = details::ECMAP.at(res);
-        }
-        else if (range)
+        else if (s.edge_type == NFAState::EdgeType::CCL || s.edge_type == NFAState::EdgeType::COUNT)
         {
-            for (; left <= res; ++left)
+            auto label = dot_bytes(sets[s.input_set]);
+            if (s.edge_type == NFAState::EdgeType::COUNT)
             {
-                ret.set(left);
+                auto &repeat = repeats[s.repeat];
+                label += " {" + std::to_string(repeat.min) + ","
+                    + (repeat.max == Repeat::UNBOUNDED ? "" : std::to_string(repeat.max)) + "}";
             }
+            res += edge + std::to_string(s.next) + " [label=\"" + label + "\"];\n";
         }
-        else
-        {
-            left = res;
-        }
-        if (!range && details::ECMAP.count(res))
+    }
+    return res + "}\n";
+}
+
+// hash of a sorted set of nfa state ids, used to index the dfa states
+class StateSetHash
+{
+  public:
+    std::size_t operator()(const std::vector<int> &set) const
+    {
+        std::size_t hash = 14695981039346656037ULL;
+        for (auto s: set)
         {
-            left = 255;
+            hash = (hash ^ static_cast<std::size_t>(s)) * 1099511628211ULL;
         }
-        return ret;
+        return hash;
     }
+};
 
-    std::shared_ptr<Node>
-    translate_echr2node(const unsigned char *&reading)
+// arena of nfa states, owned by a single compile and freed in one shot with it
+class NFA
+{
+  private:
+    ByteClasses classes;
+    std::unordered_map<std::bitset<256>, std::uint32_t> set_ids;
+    std::vector<std::vector<int>> closure;
+    std::vector<std::vector<bool>> in_class;
+    std::vector<int> tag_of;
+
+    // lowers the states of mp into a flat table, block[i] is the table id of mp[i]
+    // and block 0 is reserved for the dead state
+    DFA lower(const std::vector<DFAState> &mp, const std::vector<int> &block, int nblocks)
     {
-        std::shared_ptr<Node> node = nullptr;
-        unsigned char left = 255;
-        auto res = translate_echr2bset(left, reading, false);
-        if (left == 255)
+        DFA dfa(classes, symbols());
+        for (int i = 1; i < nblocks; ++i)
         {
-            node = std::make_shared<BracketNode>(res);
+            dfa.add_state(false);
         }
-        else
+
+        for (int i = 0; i < (int)mp.size(); ++i)
         {
-            node = std::make_shared<LeafNode>(left);
+            auto id = static_cast<std::uint32_t>(block[i]);
+            if (mp[i].state_type == DFAState::State::END)
+            {
+                dfa.accept[id] = true;
+            }
+            dfa.tag[id] = mp[i].tag;
+            for (int c = 0; c < symbols(); ++c)
+            {
+                if (mp[i].to[c] != -1)
+                {
+                    dfa.table[id * dfa.stride + c] = block[mp[i].to[c]];
+                }
+            }
         }
-        return node;
+        dfa.start = block[0];
+        return dfa;
     }
 
-    std::shared_ptr<Node>
-    gen_bracket(const unsigned char *&reading)
+    // hopcroft's partition refinement over the completed dfa,
+    // the extra state n stands for the dead state
+    DFA dfa_minimization(const std::vector<DFAState> &mp)
     {
-        unsigned char left = 255;
-        bool range = false, exclude = false;
-        std::bitset<256> chrs;
+        int n = (int)mp.size() + 1, k = symbols();
 
-        if (*reading == '^')
+        auto target = [&](int s, int c)
         {
-            ++reading;
-            exclude = true;
+            return (s == n - 1 || mp[s].to[c] == -1) ? n - 1 : mp[s].to[c];
+        };
+
+        // inverse transitions, sources of t on c are inv[inv_at[t * k + c], inv_at[t * k + c + 1])
+        std::vector<int> inv_at(n * k + 1, 0), inv(n * k);
+        for (int s = 0; s < n; ++s)
+        {
+            for (int c = 0; c < k; ++c)
+            {
+                ++inv_at[target(s, c) * k + c + 1];
+            }
         }
-        if (*reading == ']')
+        for (int i = 0; i < n * k; ++i)
         {
-            return std::make_shared<BracketNode>(chrs);
+            inv_at[i + 1] += inv_at[i];
         }
-
-        while (*reading && *reading != ']')
         {
-            if (*reading == '-')
+            auto fill = inv_at;
+            for (int s = 0; s < n; ++s)
             {
-                if (!range && left != 255)
+                for (int c = 0; c < k; ++c)
                 {
-                    range = true;
+                    inv[fill[target(s, c) * k + c]++] = s;
                 }
             }
-            else if (range)
+        }
+
+        // refinable partition, block b owns elems[first[b], last[b]) and
+        // the marked ones are moved to the front of it, up to mid[b]
+        std::vector<int> elems(n), loc(n), blk(n);
+        std::vector<int> first, last, mid;
+        std::vector<bool> pending;
+
+        // the initial blocks part the accepting states from the others and, in a
+        // tagged union, the states accepting different sets of patterns
+        {
+            std::map<std::pair<bool, std::uint32_t>, int> initial;
+            auto key = [&](int s)
             {
-                if (*reading == '\\')
-                {
-                    chrs |= translate_echr2bset(left, reading, true);
-                }
-                else
+                return s == n - 1
+                    ? std::make_pair(false, 0u)
+                    : std::make_pair(mp[s].state_type == DFAState::State::END, mp[s].tag);
+            };
+            for (int s = 0; s < n; ++s)
+            {
+                ++initial[key(s)];
+            }
+
+            int at = 0;
+            for (auto &block: initial)
+            {
+                first.push_back(at);
+                mid.push_back(at);
+                at += block.second;
+                last.push_back(at);
+                pending.push_back(true);
+                block.second = (int)first.size() - 1;
+            }
+            for (int s = 0; s < n; ++s)
+            {
+                int b = initial[key(s)];
+                blk[s] = b;
+                loc[s] = mid[b];
+                elems[mid[b]++] = s;
+            }
+            mid = first;
+        }
+
+        std::vector<int> work_list, touched;
+        for (int b = 0; b < (int)first.size(); ++b)
+        {
+            work_list.push_back(b);
+        }
+
+        auto mark = [&](int s)
+        {
+            int b = blk[s], i = loc[s];
+            if (i >= mid[b])
+            {
+                if (mid[b] == first[b])
                 {
-                    for(; left <= *reading; ++left) chrs.set(left);
+                    touched.push_back(b);
                 }
-                left = 255;
-                range = false;
+                int j = mid[b]++;
+                std::swap(elems[i], elems[j]);
+                loc[elems[i]] = i;
+                loc[elems[j]] = j;
             }
-            else
+        };
+
+        while (work_list.size())
+        {
+            int splitter = work_list.back();
+            work_list.pop_back();
+            pending[splitter] = false;
+
+            std::vector<int> members(elems.begin() + first[splitter], elems.begin() + last[splitter]);
+            for (int c = 0; c < k; ++c)
             {
-                if (left != 255)
+                for (auto t: members)
                 {
-                    chrs.set(left);
+                    for (int i = inv_at[t * k + c]; i < inv_at[t * k + c + 1]; ++i)
+                    {
+                        mark(inv[i]);
+                    }
                 }
-                if (*reading == '\\')
+
+                for (auto b: touched)
                 {
-                    chrs |= translate_echr2bset(left, reading, false);
+                    if (mid[b] == last[b])
+                    {
+                        mid[b] = first[b];
+                        continue;
+                    }
+
+                    int nb = (int)first.size();
+                    first.push_back(first[b]);
+                    last.push_back(mid[b]);
+                    mid.push_back(first[b]);
+                    first[b] = mid[b];
+                    for (int i = first[nb]; i < last[nb]; ++i)
+                    {
+                        blk[elems[i]] = nb;
+                    }
+
+                    bool smaller = last[nb] - first[nb] <= last[b] - first[b];
+                    pending.push_back(pending[b] || smaller);
+                    if (pending.back())
+                    {
+                        work_list.push_back(nb);
+                    }
+                    if (!pending[b] && !smaller)
+                    {
+                        pending[b] = true;
+                        work_list.push_back(b);
+                    }
                 }
-                else left = *reading;
+                touched.clear();
             }
-            ++reading;
         }
 
-        if (left != 255)
+        // number the blocks so that the dead state's block becomes 0
+        std::vector<int> id(first.size(), -1), block(n - 1);
+        int nblocks = 1;
+        id[blk[n - 1]] = 0;
+        for (int s = 0; s < n - 1; ++s)
         {
-            chrs.set(left);
+            if (id[blk[s]] == -1)
+            {
+                id[blk[s]] = nblocks++;
+            }
+            block[s] = id[blk[s]];
         }
+        return lower(mp, block, nblocks);
+    }
 
-        if (exclude)
+  public:
+    std::vector<NFAState> states;
+    std::vector<std::bitset<256>> sets;
+    std::uint32_t start, end;
+    // the self loop on every byte of an unanchored nfa, the extra stop
+    // symbol after the byte classes removes it from a state set
+    std::uint32_t loop;
+    // whether an unanchored nfa has the stop symbol, a reverse one is never stopped
+    bool stoppable;
+    // the end state of every pattern of a tagged union, in place of end
+    std::vector<std::uint32_t> ends;
+    // the bounds of the COUNT states
+    std::vector<Repeat> repeats;
+
+    // an nfa is never written out to more states, a pattern whose repetitions
+    // take more is rejected like a count out of range
+    static constexpr std::size_t MAX_STATES = 1 << 22;
+    // the states the stop symbol may add to the dfa of an unanchored nfa, per state it
+    // has without them, as a run of a counted atom adds one per span of it; past that
+    // to_dfa gives up on a dfa built under a limit
+    static constexpr std::size_t MAX_STOPPED = 4;
+
+    NFA() : start(NFAState::NONE), end(NFAState::NONE), loop(NFAState::NONE), stoppable(true) {}
+
+    // throws before count more copies of states states each are added past MAX_STATES
+    void reserve(std::size_t states, std::size_t count) const
+    {
+        if (count && states > (MAX_STATES - std::min(MAX_STATES, this->states.size())) / count)
         {
-            chrs.flip();
+            throw std::out_of_range("cre: repetition count out of range");
         }
+    }
 
-        return std::make_shared<BracketNode>(chrs);
+    std::uint32_t new_state(NFAState::EdgeType edge_type = NFAState::EdgeType::EMPTY)
+    {
+        states.emplace_back();
+        states.back().edge_type = edge_type;
+        return static_cast<std::uint32_t>(states.size() - 1);
     }
 
-    std::shared_ptr<Node>
-    gen_subexpr(const unsigned char *&reading)
+    // pair of fresh states, start -> end is left to the caller
+    NFAPair new_pair()
     {
-        std::shared_ptr<Node> node = nullptr;
-        if (*reading == '?')
+        auto start = new_state();
+        return NFAPair(start, new_state());
+    }
+
+    std::uint32_t add_set(const std::bitset<256> &set)
+    {
+        auto it = set_ids.find(set);
+        if (it == set_ids.end())
         {
-            ++reading;
-            if (*reading == ':')
-            {
-                ++reading;
-            }
-            if (*reading == '<')
-            {
-                ++reading;
-            }
-            std::string name;
-            while (isalnum(*reading) || *reading == '_')
+            it = set_ids.emplace(set, static_cast<std::uint32_t>(sets.size())).first;
+            sets.push_back(set);
+        }
+        return it->second;
+    }
+
+    // the nfa with every COUNT state written out as a chain of input_set states, the
+    // first of them in its place, or nothing if that takes more than limit states;
+    // the other methods expect an nfa without any
+    std::optional<NFA> unrolled(std::size_t limit = MAX_STATES) const
+    {
+        auto size = states.size();
+        for (auto &state: states)
+        {
+            if (state.edge_type == NFAState::EdgeType::COUNT)
             {
-                name += *reading++;
+                auto &repeat = repeats[state.repeat];
+                std::size_t rounds = repeat.max == Repeat::UNBOUNDED ? repeat.min + std::size_t(1) : repeat.max;
+                size += 2 * rounds - 1;
+                if (size > limit)
+                {
+                    return std::nullopt;
+                }
             }
-            if (*reading == '>')
+        }
+
+        NFA nfa = *this;
+        nfa.repeats.clear();
+        for (std::uint32_t i = 0; i < states.size(); ++i)
+        {
+            if (states[i].edge_type != NFAState::EdgeType::COUNT)
             {
-                ++reading;
+                continue;
             }
-            if (*reading == ')')
+
+            // at is entered after k rounds, from min on it may also leave for next
+            auto next = states[i].next, input_set = states[i].input_set;
+            auto &repeat = repeats[states[i].repeat];
+            auto at = i;
+            for (std::uint32_t k = 0; ; ++k)
             {
-                if (ref_map.count(name))
+                auto step = nfa.new_state(NFAState::EdgeType::CCL);
+                nfa.states[step].input_set = input_set;
+                nfa.states[at].edge_type = NFAState::EdgeType::EPSILON;
+                nfa.states[at].next = step;
+                nfa.states[at].next2 = k < repeat.min ? NFAState::NONE : next;
+                if (k == repeat.max - 1 || (repeat.max == Repeat::UNBOUNDED && k == repeat.min))
                 {
-                    return ref_map[name];
+                    // the last round, or the one looping back for {n,}
+                    nfa.states[step].next = repeat.max == Repeat::UNBOUNDED ? at : next;
+                    break;
                 }
-            }
-            else
-            {
-                node = gen_node(reading);
-                ref_map[name] = node;
+                at = nfa.new_state();
+                nfa.states[step].next = at;
             }
         }
-        else
+        return nfa;
+    }
+
+    // the nfa with every COUNT state written out to at most rounds rounds, a lower bound
+    // past them cut to rounds and an upper one made unbounded: it accepts every word
+    // this one does and more, enough for a prefilter, which looks at the first bytes only
+    std::optional<NFA> widened(std::uint32_t rounds) const
+    {
+        NFA nfa = *this;
+        for (auto &repeat: nfa.repeats)
         {
-            node = gen_node(reading);
+            if (repeat.max != Repeat::UNBOUNDED && repeat.max > rounds)
+            {
+                repeat.max = Repeat::UNBOUNDED;
+            }
+            repeat.min = std::min(repeat.min, rounds);
         }
-        return node;
+        return nfa.unrolled();
     }
 
-    std::shared_ptr<Node>
-    gen_node(const unsigned char *&reading)
+    // computes the byte classes and the memoized epsilon closures,
+    // must be called once the nfa is complete and before any step
+    void prepare()
     {
-        std::shared_ptr<Node> node = nullptr, right = nullptr;
+        classes = ByteClasses(sets);
 
-        if (*reading == '^')
+        int n = (int)states.size();
+
+        tag_of.assign(n, -1);
+        for (std::size_t i = 0; i < ends.size(); ++i)
         {
-            ++reading;
-            begin = true;
+            tag_of[ends[i]] = (int)i;
         }
 
-        if (*reading == '(')
+        // epsilon closure of the start state and of every input edge target, keeping
+        // only the states that matter to the dfa: the ones with an input edge and the
+        // end state, the split states of a wide alternation get none of their own
+        std::vector<bool> needed(n, false);
+        needed[start] = true;
+        for (auto &s: states)
         {
-            ++reading;
-            node = gen_subexpr(reading);
+            if (s.edge_type == NFAState::EdgeType::CCL)
+            {
+                needed[s.next] = true;
+            }
+        }
+
+        closure.assign(n, {});
+        {
+            std::vector<int> seen(n, -1), stack;
+            for (int i = 0; i < n; ++i)
+            {
+                if (!needed[i])
+                {
+                    continue;
+                }
+                stack.push_back(i);
+                seen[i] = i;
+                while (stack.size())
+                {
+                    int id = stack.back();
+                    auto &s = states[id];
+                    stack.pop_back();
+                    if (s.edge_type == NFAState::EdgeType::EPSILON)
+                    {
+                        for (auto next: {s.next, s.next2})
+                        {
+                            if (next != NFAState::NONE && seen[next] != i)
+                            {
+                                seen[next] = i;
+                                stack.push_back((int)next);
+                            }
+                        }
+                    }
+                    else if (s.edge_type == NFAState::EdgeType::CCL || id == (int)end || tag_of[id] != -1)
+                    {
+                        closure[i].push_back(id);
+                    }
+                }
+                std::sort(closure[i].begin(), closure[i].end());
+            }
+        }
+
+        in_class.assign(sets.size(), std::vector<bool>(classes.size()));
+        for (int k = 0; k < (int)sets.size(); ++k)
+        {
+            for (int c = 0; c < (int)classes.size(); ++c)
+            {
+                in_class[k][c] = sets[k][classes.reps[c]];
+            }
+        }
+    }
+
+    const ByteClasses &byte_classes() const
+    {
+        return classes;
+    }
+
+    // byte classes plus the stop symbol of an unanchored nfa
+    int symbols() const
+    {
+        return (int)classes.size() + (loop != NFAState::NONE && stoppable);
+    }
+
+    bool nullable() const
+    {
+        std::vector<bool> seen(states.size());
+        std::vector<std::uint32_t> stack = {start};
+        while (stack.size())
+        {
+            auto s = stack.back();
+            stack.pop_back();
+            if (s == end)
+            {
+                return true;
+            }
+            if (s == NFAState::NONE || seen[s] || states[s].edge_type != NFAState::EdgeType::EPSILON)
+            {
+                continue;
+            }
+            seen[s] = true;
+            stack.push_back(states[s].next);
+            stack.push_back(states[s].next2);
+        }
+        return false;
+    }
+
+    // the nfa of the nonempty words of this one, a second copy of the
+    // states is entered by the first consumed byte and holds the end;
+    // the nfa must be unrolled, COUNT states would be copied as they are
+    NFA nonempty() const
+    {
+        assert(repeats.empty());
+        if (!nullable())
+        {
+            return *this;
+        }
+
+        NFA nfa;
+        nfa.sets = sets;
+        nfa.set_ids = set_ids;
+        auto n = static_cast<std::uint32_t>(states.size());
+        nfa.states.resize(2 * n);
+        for (std::uint32_t layer = 0; layer < 2; ++layer)
+        {
+            for (std::uint32_t i = 0; i < n; ++i)
+            {
+                auto state = states[i];
+                if (state.edge_type == NFAState::EdgeType::CCL)
+                {
+                    state.next += n;
+                }
+                else if (state.edge_type == NFAState::EdgeType::EPSILON)
+                {
+                    state.next += layer * n;
+                    if (state.next2 != NFAState::NONE)
+                    {
+                        state.next2 += layer * n;
+                    }
+                }
+                nfa.states[layer * n + i] = state;
+            }
+        }
+        nfa.start = start;
+        nfa.end = end + n;
+        return nfa;
+    }
+
+    // the nfa of the reversed words, every edge is turned around and a state
+    // with several incoming edges fans out to them through epsilon states;
+    // the nfa must be unrolled, COUNT states would lose their edges
+    NFA reversed() const
+    {
+        assert(repeats.empty());
+        NFA nfa;
+        nfa.sets = sets;
+        nfa.set_ids = set_ids;
+        nfa.states.resize(states.size());
+
+        // incoming edges of each state, as the source and the input set or NONE
+        std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> in(states.size());
+        for (std::uint32_t i = 0; i < states.size(); ++i)
+        {
+            auto &state = states[i];
+            if (state.edge_type == NFAState::EdgeType::CCL)
+            {
+                in[state.next].emplace_back(i, state.input_set);
+            }
+            else if (state.edge_type == NFAState::EdgeType::EPSILON)
+            {
+                in[state.next].emplace_back(i, NFAState::NONE);
+                if (state.next2 != NFAState::NONE)
+                {
+                    in[state.next2].emplace_back(i, NFAState::NONE);
+                }
+            }
+        }
+
+        for (std::uint32_t i = 0; i < states.size(); ++i)
+        {
+            auto at = i;
+            for (std::size_t k = 0; k < in[i].size(); ++k)
+            {
+                auto target = in[i][k].first;
+                if (in[i][k].second != NFAState::NONE)
+                {
+                    target = nfa.new_state(NFAState::EdgeType::CCL);
+                    nfa.states[target].input_set = in[i][k].second;
+                    nfa.states[target].next = in[i][k].first;
+                }
+
+                nfa.states[at].edge_type = NFAState::EdgeType::EPSILON;
+                nfa.states[at].next = target;
+                if (k + 1 < in[i].size())
+                {
+                    auto rest = nfa.new_state(NFAState::EdgeType::EPSILON);
+                    nfa.states[at].next2 = rest;
+                    at = rest;
+                }
+            }
+        }
+
+        nfa.start = end;
+        nfa.end = start;
+        return nfa;
+    }
+
+    // a state that leads to every one of targets through a chain of epsilon states
+    std::uint32_t fan_out(const std::vector<std::uint32_t> &targets)
+    {
+        if (targets.empty())
+        {
+            return new_state();
+        }
+
+        auto at = targets.back();
+        for (auto i = targets.size() - 1; i-- > 0; )
+        {
+            auto split = new_state(NFAState::EdgeType::EPSILON);
+            states[split].next = targets[i];
+            states[split].next2 = at;
+            at = split;
+        }
+        return at;
+    }
+
+    // the union of nfas, the end of nfas[i] accepts with tag i; the anchored ones are
+    // entered at the first byte only, the others also through a self loop on every byte
+    static NFA tagged_union(const std::vector<NFA> &nfas, const std::vector<bool> &anchored)
+    {
+        NFA nfa;
+        std::vector<std::uint32_t> starts, loose;
+        for (std::size_t i = 0; i < nfas.size(); ++i)
+        {
+            auto offset = static_cast<std::uint32_t>(nfa.states.size());
+            for (auto state: nfas[i].states)
+            {
+                if (state.edge_type == NFAState::EdgeType::CCL)
+                {
+                    state.input_set = nfa.add_set(nfas[i].sets[state.input_set]);
+                }
+                if (state.next != NFAState::NONE)
+                {
+                    state.next += offset;
+                }
+                if (state.next2 != NFAState::NONE)
+                {
+                    state.next2 += offset;
+                }
+                nfa.states.push_back(state);
+            }
+            (anchored[i] ? starts : loose).push_back(nfas[i].start + offset);
+            nfa.ends.push_back(nfas[i].end + offset);
+        }
+
+        if (loose.size())
+        {
+            auto self = nfa.new_state(NFAState::EdgeType::CCL);
+            nfa.states[self].input_set = nfa.add_set(std::bitset<256>().set());
+            loose.push_back(self);
+            auto split = nfa.fan_out(loose);
+            nfa.states[self].next = split;
+            starts.push_back(split);
+        }
+        nfa.start = nfa.fan_out(starts);
+        return nfa;
+    }
+
+    // the nfa that may start matching at any position, through a self loop on every byte
+    NFA unanchored(bool stoppable = true) const
+    {
+        NFA nfa = *this;
+        nfa.stoppable = stoppable;
+        auto split = nfa.new_state(NFAState::EdgeType::EPSILON);
+        nfa.loop = nfa.new_state(NFAState::EdgeType::CCL);
+
+        nfa.states[nfa.loop].input_set = nfa.add_set(std::bitset<256>().set());
+        nfa.states[nfa.loop].next = split;
+        nfa.states[split].next = nfa.loop;
+        nfa.states[split].next2 = start;
+
+        nfa.start = split;
+        return nfa;
+    }
+
+    const std::vector<int> &start_set() const
+    {
+        return closure[start];
+    }
+
+    bool is_end(const std::vector<int> &q) const
+    {
+        if (ends.size())
+        {
+            return std::any_of(q.begin(), q.end(), [&](int s) { return tag_of[s] != -1; });
+        }
+        return std::binary_search(q.begin(), q.end(), (int)end);
+    }
+
+    // the patterns of a tagged union whose end is in q, in increasing order
+    std::vector<std::uint32_t> tags(const std::vector<int> &q) const
+    {
+        std::vector<std::uint32_t> res;
+        for (auto s: q)
+        {
+            if (tag_of[s] != -1)
+            {
+                res.push_back(static_cast<std::uint32_t>(tag_of[s]));
+            }
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    // the sorted set of states reached from q on byte class c, mark is a scratch
+    // array sized to the nfa and stamp a value it holds nowhere yet
+    void step(const std::vector<int> &q, int c, std::vector<int> &t,
+        std::vector<int> &mark, int stamp) const
+    {
+        t.clear();
+        if (c == (int)classes.size())
+        {
+            for (auto s: q)
+            {
+                if (s != (int)loop)
+                {
+                    t.push_back(s);
+                }
+            }
+            return;
+        }
+        for (auto s: q)
+        {
+            if (states[s].edge_type == NFAState::EdgeType::CCL && in_class[states[s].input_set][c])
+            {
+                for (auto x: closure[states[s].next])
+                {
+                    if (mark[x] != stamp)
+                    {
+                        mark[x] = stamp;
+                        t.push_back(x);
+                    }
+                }
+            }
+        }
+        std::sort(t.begin(), t.end());
+    }
+
+    DFA to_dfa(bool minimize)
+    {
+        return *to_dfa(minimize, 0);
+    }
+
+    // the dfa, or nothing once the subset construction takes more than capacity
+    // bytes or limit states, unless those are 0, or under a limit once the stop
+    // column takes more than MAX_STOPPED states per state before it; with neither
+    // it always builds the dfa; the states and times of both phases are added to stats
+    std::optional<DFA> to_dfa(bool minimize, std::size_t capacity, Stats *stats = nullptr, std::size_t limit = 0)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        prepare();
+
+        std::unordered_map<std::vector<int>, int, StateSetHash> index;
+        std::vector<const std::vector<int> *> Q;
+        std::vector<DFAState> mp;
+        std::vector<int> work_list;
+        std::vector<std::vector<std::uint32_t>> tag_sets(1);
+        std::map<std::vector<std::uint32_t>, std::uint32_t> tag_ids = {{{}, 0}};
+        std::size_t bytes = 0;
+
+        auto add = [&](std::vector<int> &&t)
+        {
+            auto res = index.emplace(std::move(t), (int)Q.size());
+            if (res.second)
+            {
+                auto &q = res.first->first;
+                bytes += sizeof(DFAState) + (symbols() + q.size()) * sizeof(int) + 4 * sizeof(void *);
+                auto tag = tag_ids.emplace(tags(q), static_cast<std::uint32_t>(tag_sets.size()));
+                if (tag.second)
+                {
+                    tag_sets.push_back(tag.first->first);
+                }
+                Q.push_back(&q);
+                work_list.push_back(res.first->second);
+                mp.push_back(DFAState(is_end(q)
+                    ? DFAState::State::END
+                    : DFAState::State::NORMAL, symbols(), tag.first->second));
+            }
+            return res.first->second;
+        };
+
+        add(std::vector<int>(start_set()));
+
+        // the states with the loop come first, then the ones the stop symbol leads to
+        // from them, which take a state per span of a run of a counted atom
+        std::vector<int> mark(states.size(), -1), t, stopping;
+        int stamp = 0, stop = (int)classes.size();
+        std::size_t looping = 0;
+        auto edge = [&](int q, int c)
+        {
+            step(*Q[q], c, t, mark, stamp++);
+            if (t.size())
+            {
+                int id = add(std::vector<int>(t));
+                mp[q].to[c] = id;
+            }
+            return (!capacity || bytes <= capacity) && (!limit || mp.size() <= limit)
+                && (!limit || !looping || mp.size() - looping <= MAX_STOPPED * looping);
+        };
+        while (true)
+        {
+            while (work_list.size())
+            {
+                int q = work_list.back();
+                work_list.pop_back();
+                for (int c = 0; c < symbols(); ++c)
+                {
+                    if (c == stop && !looping)
+                    {
+                        stopping.push_back(q);
+                    }
+                    else if (!edge(q, c))
+                    {
+                        return std::nullopt;
+                    }
+                }
+            }
+            if (looping || stopping.empty())
+            {
+                break;
+            }
+            looping = mp.size();
+            for (auto q: stopping)
+            {
+                if (!edge(q, stop))
+                {
+                    return std::nullopt;
+                }
+            }
+        }
+
+        auto subset = std::chrono::steady_clock::now();
+        DFA dfa;
+        if (minimize)
+        {
+            dfa = dfa_minimization(mp);
+        }
+        else
+        {
+            std::vector<int> block(mp.size());
+            for (int i = 0; i < (int)mp.size(); ++i)
+            {
+                block[i] = i + 1;
+            }
+            dfa = lower(mp, block, (int)mp.size() + 1);
+        }
+        dfa.tag_sets = std::move(tag_sets);
+        if (stats)
+        {
+            stats->subset_states += mp.size() + 1;
+            stats->dfa_states += dfa.accept.size();
+            // the table of a dfa left as it is is written out with the subset construction
+            auto done = std::chrono::steady_clock::now();
+            stats->subset_time += (minimize ? subset : done) - begin;
+            if (minimize)
+            {
+                stats->minimize_time += done - subset;
+            }
+        }
+        return dfa;
+    }
+
+    // the bytes of the states, sets and memoized closures
+    std::size_t bytes() const
+    {
+        std::size_t res = states.size() * sizeof(NFAState) + sets.size() * sizeof(std::bitset<256>)
+            + repeats.size() * sizeof(Repeat) + ends.size() * sizeof(std::uint32_t) + tag_of.size() * sizeof(int);
+        for (auto &states: closure)
+        {
+            res += states.size() * sizeof(int);
+        }
+        for (auto &symbols: in_class)
+        {
+            res += symbols.size() / 8;
+        }
+        return res;
+    }
+
+    std::string dot() const
+    {
+        return nfa_dot(states, sets, repeats, start, end);
+    }
+};
+
+// determinizes the nfa while scanning, the states the input reaches are kept in a
+// cache owned by the caller, so one lazy dfa serves any number of threads; when a
+// cache outgrows the capacity it is flushed and refilled on demand
+class LazyDFA
+{
+  public:
+    static constexpr std::uint32_t DEAD = 0, START = 1, UNKNOWN = UINT32_MAX;
+
+    // the states one caller has reached so far, state 0 is the empty set and
+    // stays dead on every input, state 1 is the start set
+    class Cache
+    {
+      public:
+        std::size_t memory;
+        std::vector<std::vector<int>> sets;
+        std::unordered_multimap<std::size_t, std::uint32_t> index;
+        std::vector<std::uint32_t> table;
+        std::vector<unsigned char> accept;
+        // as in DFA, the tag sets are kept across flushes
+        std::vector<std::uint32_t> tag;
+        std::vector<std::vector<std::uint32_t>> tag_sets;
+        std::map<std::vector<std::uint32_t>, std::uint32_t> tag_ids;
+        std::vector<int> mark, scratch;
+        int stamp;
+        // the states before the last flush, and the number of flushes so far
+        std::vector<std::vector<int>> retired;
+        std::size_t flushes;
+
+        Cache() : memory(0), stamp(0), flushes(0) {}
+    };
+
+    // a lazy dfa bound to a cache, scanned like a dfa
+    class Scan
+    {
+      private:
+        const LazyDFA &dfa;
+        Cache &cache;
+
+      public:
+        static constexpr std::uint32_t DEAD = LazyDFA::DEAD;
+
+        std::vector<unsigned char> &accept;
+        std::vector<std::uint32_t> &tag;
+        std::vector<std::vector<std::uint32_t>> &tag_sets;
+        std::uint32_t start;
+
+        Scan(const LazyDFA &dfa, Cache &cache)
+          : dfa(dfa), cache(cache), accept(cache.accept), tag(cache.tag), tag_sets(cache.tag_sets), start(START) {}
+
+        std::uint32_t next(std::uint32_t state, unsigned char c)
+        {
+            int cls = dfa.nfa.byte_classes().map[c];
+            auto to = cache.table[state * dfa.stride + cls];
+            return to == UNKNOWN ? dfa.compute(cache, state, cls) : to;
+        }
+
+        std::uint32_t stop(std::uint32_t state)
+        {
+            auto to = cache.table[state * dfa.stride + dfa.stride - 1];
+            return to == UNKNOWN ? dfa.compute(cache, state, (int)dfa.stride - 1) : to;
+        }
+
+        std::size_t size() const
+        {
+            return cache.sets.size();
+        }
+
+        std::size_t flushes() const
+        {
+            return cache.flushes;
+        }
+
+        // the id now of a state held from before the last flush, for a caller
+        // that holds more than the one state a flush keeps
+        std::uint32_t revive(std::uint32_t state)
+        {
+            return dfa.intern(cache, cache.retired[state]);
+        }
+    };
+
+  private:
+    NFA nfa;
+    std::size_t capacity, stride;
+
+    std::uint32_t add_state(Cache &cache, const std::vector<int> &set, std::size_t hash) const
+    {
+        auto id = static_cast<std::uint32_t>(cache.sets.size());
+        cache.sets.push_back(set);
+        cache.index.emplace(hash, id);
+        cache.table.resize(cache.table.size() + stride, UNKNOWN);
+        cache.accept.push_back(nfa.is_end(set));
+        if (nfa.ends.size())
+        {
+            auto tags = nfa.tags(set);
+            auto it = cache.tag_ids.emplace(tags, static_cast<std::uint32_t>(cache.tag_sets.size()));
+            if (it.second)
+            {
+                cache.tag_sets.push_back(tags);
+            }
+            cache.tag.push_back(it.first->second);
+        }
+        else
+        {
+            cache.tag.push_back(0);
+        }
+        cache.memory += sizeof(std::vector<int>) + set.size() * sizeof(int)
+            + stride * sizeof(std::uint32_t) + 4 * sizeof(void *);
+        return id;
+    }
+
+    // the id of set, added without flushing if it is new
+    std::uint32_t intern(Cache &cache, const std::vector<int> &set) const
+    {
+        auto hash = StateSetHash()(set);
+        auto range = cache.index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (cache.sets[it->second] == set)
+            {
+                return it->second;
+            }
+        }
+        return add_state(cache, set, hash);
+    }
+
+    void clear(Cache &cache) const
+    {
+        cache.retired.swap(cache.sets);
+        cache.sets.clear();
+        ++cache.flushes;
+        cache.index.clear();
+        cache.table.clear();
+        cache.accept.clear();
+        cache.tag.clear();
+        cache.memory = 0;
+        if (cache.tag_sets.empty())
+        {
+            cache.tag_sets.emplace_back();
+            cache.tag_ids.emplace(std::vector<std::uint32_t>(), 0);
+            cache.mark.assign(nfa.states.size(), -1);
+        }
+
+        add_state(cache, {}, StateSetHash()({}));
+        add_state(cache, nfa.start_set(), StateSetHash()(nfa.start_set()));
+        std::fill(cache.table.begin(), cache.table.begin() + stride, DEAD);
+    }
+
+    std::uint32_t compute(Cache &cache, std::uint32_t state, int c) const
+    {
+        nfa.step(cache.sets[state], c, cache.scratch, cache.mark, cache.stamp++);
+
+        auto hash = StateSetHash()(cache.scratch);
+        auto range = cache.index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (cache.sets[it->second] == cache.scratch)
+            {
+                return cache.table[state * stride + c] = it->second;
+            }
+        }
+
+        if (cache.memory >= capacity)
+        {
+            // the ids held by the caller die here, only the target survives
+            clear(cache);
+            return add_state(cache, cache.scratch, hash);
+        }
+        auto id = add_state(cache, cache.scratch, hash);
+        return cache.table[state * stride + c] = id;
+    }
+
+  public:
+    LazyDFA() : LazyDFA(NFA(), 0) {}
+    LazyDFA(NFA nfa, std::size_t capacity) : nfa(std::move(nfa)), capacity(capacity), stride(0)
+    {
+        if (this->nfa.start != NFAState::NONE)
+        {
+            this->nfa.prepare();
+            stride = this->nfa.symbols();
+        }
+    }
+
+    Scan bind(Cache &cache) const
+    {
+        if (cache.sets.empty())
+        {
+            clear(cache);
+        }
+        return Scan(*this, cache);
+    }
+
+    const ByteClasses &byte_classes() const
+    {
+        return nfa.byte_classes();
+    }
+
+    // the bytes of the nfa it determinizes, the caches are the callers'
+    std::size_t bytes() const
+    {
+        return nfa.bytes();
+    }
+
+    std::string dot() const
+    {
+        return nfa.dot();
+    }
+};
+
+// finds the leftmost occurrence of a few literals sorted into eight buckets: the low
+// and high nibbles of the first bytes at a position are looked up in per bucket
+// masks and only the literals of the buckets left standing are compared in full
+class Teddy
+{
+  private:
+    std::vector<std::string> literals;
+    std::vector<unsigned> bucket;
+    std::size_t width;
+    std::array<std::array<unsigned char, 16>, 3> lo, hi;
+    std::array<std::array<unsigned char, 256>, 3> masks;
+
+    bool verify(const unsigned char *data, std::size_t size, std::size_t at, unsigned buckets) const
+    {
+        for (std::size_t i = 0; i < literals.size(); ++i)
+        {
+            auto &literal = literals[i];
+            if ((buckets & bucket[i]) && at + literal.size() <= size
+                && !std::memcmp(data + at, literal.data(), literal.size()))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::size_t scan(const unsigned char *data, std::size_t size, std::size_t from) const
+    {
+        for (; from + width <= size; ++from)
+        {
+            unsigned buckets = masks[0][data[from]];
+            for (std::size_t k = 1; k < width && buckets; ++k)
+            {
+                buckets &= masks[k][data[from + k]];
+            }
+            if (buckets && verify(data, size, from, buckets))
+            {
+                return from;
+            }
+        }
+        return size;
+    }
+
+#ifdef CRE_SSSE3
+    // sixteen positions a step, the nibble lookups are byte shuffles
+    __attribute__((target("ssse3")))
+    std::size_t scan_ssse3(const unsigned char *data, std::size_t size, std::size_t from) const
+    {
+        __m128i lo_mask[3], hi_mask[3];
+        for (std::size_t k = 0; k < width; ++k)
+        {
+            lo_mask[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo[k].data()));
+            hi_mask[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi[k].data()));
+        }
+
+        const auto nibble = _mm_set1_epi8(0x0f);
+        for (; from + 15 + width <= size; from += 16)
+        {
+            auto res = _mm_set1_epi8(-1);
+            for (std::size_t k = 0; k < width; ++k)
+            {
+                auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from + k));
+                auto low = _mm_shuffle_epi8(lo_mask[k], _mm_and_si128(chunk, nibble));
+                auto high = _mm_shuffle_epi8(hi_mask[k], _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble));
+                res = _mm_and_si128(res, _mm_and_si128(low, high));
+            }
+
+            unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) ^ 0xffff;
+            if (hits)
+            {
+                alignas(16) unsigned char buckets[16];
+                _mm_store_si128(reinterpret_cast<__m128i *>(buckets), res);
+                for (; hits; hits &= hits - 1)
+                {
+                    auto i = static_cast<std::size_t>(__builtin_ctz(hits));
+                    if (verify(data, size, from + i, buckets[i]))
+                    {
+                        return from + i;
+                    }
+                }
+            }
+        }
+        return scan(data, size, from);
+    }
+#endif
+
+  public:
+    static constexpr std::size_t MAX_LITERALS = 32;
+
+    Teddy() : width(0) {}
+    Teddy(const std::vector<std::string> &literals) : literals(literals), width(3)
+    {
+        // neighbours in sorted order share a bucket, their first bytes tend to agree
+        std::sort(this->literals.begin(), this->literals.end());
+        for (std::size_t i = 0; i < literals.size(); ++i)
+        {
+            bucket.push_back(1u << (i * 8 / literals.size()));
+            width = std::min(width, literals[i].size());
+        }
+
+        for (std::size_t k = 0; k < 3; ++k)
+        {
+            lo[k].fill(0);
+            hi[k].fill(0);
+            masks[k].fill(0);
+        }
+        for (std::size_t i = 0; i < literals.size(); ++i)
+        {
+            for (std::size_t k = 0; k < width; ++k)
+            {
+                auto c = static_cast<unsigned char>(this->literals[i][k]);
+                lo[k][c & 0x0f] |= bucket[i];
+                hi[k][c >> 4] |= bucket[i];
+                masks[k][c] |= bucket[i];
+            }
+        }
+    }
+
+    // the first position at or after from where a literal occurs, or size
+    std::size_t find(const unsigned char *data, std::size_t size, std::size_t from) const
+    {
+#ifdef CRE_SSSE3
+        static const bool ssse3 = __builtin_cpu_supports("ssse3");
+        if (ssse3)
+        {
+            return scan_ssse3(data, size, from);
+        }
+#endif
+        return scan(data, size, from);
+    }
+
+    std::size_t bytes() const
+    {
+        std::size_t res = bucket.size() * sizeof(unsigned);
+        for (auto &literal: literals)
+        {
+            res += sizeof(std::string) + literal.capacity();
+        }
+        return res;
+    }
+};
+
+// finds the leftmost occurrence of many literals with a dense aho-corasick automaton
+// over the bytes they use, every other byte falls into class 0
+class AhoCorasick
+{
+  private:
+    std::array<unsigned char, 256> map;
+    std::size_t stride;
+    std::vector<std::uint32_t> table, depth, out;
+
+  public:
+    AhoCorasick() : stride(1), table(1, 0), depth(1, 0), out(1, 0)
+    {
+        map.fill(0);
+    }
+
+    AhoCorasick(const std::vector<std::string> &literals) : AhoCorasick()
+    {
+        for (auto &literal: literals)
+        {
+            for (auto c: literal)
+            {
+                auto &cls = map[static_cast<unsigned char>(c)];
+                if (!cls)
+                {
+                    cls = static_cast<unsigned char>(stride++);
+                }
+            }
+        }
+
+        // the trie, 0 stands for a missing child as no edge leads back to the root
+        table.assign(stride, 0);
+        for (auto &literal: literals)
+        {
+            std::uint32_t node = 0;
+            for (auto c: literal)
+            {
+                auto &to = table[node * stride + map[static_cast<unsigned char>(c)]];
+                if (!to)
+                {
+                    to = static_cast<std::uint32_t>(depth.size());
+                    table.resize(table.size() + stride, 0);
+                    depth.push_back(depth[node] + 1);
+                    out.push_back(0);
+                }
+                node = table[node * stride + map[static_cast<unsigned char>(c)]];
+            }
+            out[node] = static_cast<std::uint32_t>(literal.size());
+        }
+
+        // breadth first, a missing child becomes the edge of the failure state and
+        // out is the longest literal ending at a state
+        std::vector<std::uint32_t> fail(depth.size(), 0), queue = {0};
+        for (std::size_t i = 0; i < queue.size(); ++i)
+        {
+            auto node = queue[i];
+            for (std::size_t c = 0; c < stride; ++c)
+            {
+                auto &to = table[node * stride + c];
+                auto back = node ? table[fail[node] * stride + c] : 0;
+                if (to)
+                {
+                    fail[to] = back;
+                    out[to] = std::max(out[to], out[back]);
+                    queue.push_back(to);
+                }
+                else
+                {
+                    to = back;
+                }
+            }
+        }
+    }
+
+    // the first position at or after from where a literal occurs, or size
+    std::size_t find(const unsigned char *data, std::size_t size, std::size_t from) const
+    {
+        std::uint32_t state = 0;
+        auto res = size;
+        for (auto i = from; i < size; ++i)
+        {
+            state = table[state * stride + map[data[i]]];
+            if (out[state])
+            {
+                res = std::min(res, i + 1 - out[state]);
+            }
+            // no literal starting before res is still under way
+            if (res != size && i + 1 - depth[state] >= res)
+            {
+                break;
+            }
+        }
+        return res;
+    }
+
+    std::size_t bytes() const
+    {
+        return (table.size() + depth.size() + out.size()) * sizeof(std::uint32_t);
+    }
+};
+
+// skips the input between the positions where a match may start, derived from the
+// nfa of the pattern: the literals every match begins with, if they are long enough,
+// otherwise the set of bytes a match may begin with
+class Prefilter
+{
+  private:
+    enum class Kind
+    {
+        BYTES,
+        LITERAL,
+        TEDDY,
+        AHO_CORASICK
+    } kind;
+
+    std::vector<std::string> literals;
+    bool complete;
+    // the length of the longest literal looked for
+    std::size_t reach;
+    // the bytes every literal begins with, the one literal looked for by LITERAL
+    std::string prefix;
+    std::string rare;
+    std::array<bool, 256> first;
+    int nfirst;
+    Teddy teddy;
+    AhoCorasick aho_corasick;
+
+    // the words of nfa up to their first accepting state, breadth first while they
+    // stay few and short, the ones cut short are left not accepted
+    void extract(const NFA &nfa)
+    {
+        auto &classes = nfa.byte_classes();
+        std::vector<std::string> bytes(classes.size());
+        for (int c = 0; c < 256; ++c)
+        {
+            bytes[classes.map[c]] += static_cast<char>(c);
+        }
+
+        std::vector<int> mark(nfa.states.size(), -1), t;
+        int stamp = 0;
+        std::vector<std::pair<std::string, std::vector<int>>> open, grown;
+        open.emplace_back("", nfa.start_set());
+        while (open.size())
+        {
+            bool fits = true;
+            auto count = literals.size(), length = std::size_t(0);
+            grown.clear();
+            for (auto &literal: literals)
+            {
+                length += literal.size();
+            }
+            for (auto &item: open)
+            {
+                if (!fits)
+                {
+                    break;
+                }
+                for (int c = 0; fits && c < (int)classes.size(); ++c)
+                {
+                    nfa.step(item.second, c, t, mark, stamp++);
+                    if (t.empty())
+                    {
+                        continue;
+                    }
+                    count += bytes[c].size();
+                    length += bytes[c].size() * (item.first.size() + 1);
+                    fits = count <= MAX_LITERALS && length <= MAX_BYTES && item.first.size() < MAX_LENGTH;
+                    for (std::size_t i = 0; fits && i < bytes[c].size(); ++i)
+                    {
+                        grown.emplace_back(item.first + bytes[c][i], t);
+                    }
+                }
+            }
+            if (!fits)
+            {
+                break;
+            }
+
+            open.clear();
+            for (auto &item: grown)
+            {
+                if (nfa.is_end(item.second))
+                {
+                    literals.push_back(item.first);
+                }
+                else
+                {
+                    open.push_back(std::move(item));
+                }
+            }
+        }
+
+        complete = open.empty();
+        for (auto &item: open)
+        {
+            literals.push_back(item.first);
+        }
+    }
+
+  public:
+    static constexpr std::size_t MAX_LITERALS = 4096, MAX_LENGTH = 64, MAX_BYTES = 1 << 16;
+    // up to this many first bytes are looked for with one memchr each
+    static constexpr int MAX_RARE = 3;
+
+    Prefilter() : kind(Kind::BYTES), complete(false), reach(1), nfirst(256)
+    {
+        first.fill(true);
+    }
+
+    Prefilter(NFA nfa) : kind(Kind::BYTES), complete(false), reach(1), nfirst(0)
+    {
+        nfa.prepare();
+
+        std::vector<int> mark(nfa.states.size(), -1), t;
+        for (int c = 0; c < 256; ++c)
+        {
+            nfa.step(nfa.start_set(), nfa.byte_classes().map[c], t, mark, c);
+            first[c] = t.size();
+        }
+        extract(nfa);
+        build();
+    }
+
+    // the image of the first bytes and literals, the searchers are built anew on load
+    void save(Writer &out) const
+    {
+        out.u32(complete);
+        out.bytes(first.data(), first.size());
+        out.u32(static_cast<std::uint32_t>(literals.size()));
+        for (auto &literal: literals)
+        {
+            out.u32(static_cast<std::uint32_t>(literal.size()));
+            out.bytes(literal.data(), literal.size());
+        }
+    }
+
+    bool load(Reader &in)
+    {
+        complete = in.u32();
+        auto bytes = in.bytes(256);
+        std::size_t count = in.u32();
+        if (!in.ok || count > MAX_LITERALS)
+        {
+            return false;
+        }
+        for (int c = 0; c < 256; ++c)
+        {
+            first[c] = bytes[c];
+        }
+        literals.clear();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::size_t length = in.u32();
+            auto literal = in.bytes(length);
+            if (!in.ok || !length)
+            {
+                return false;
+            }
+            literals.emplace_back(reinterpret_cast<const char *>(literal), length);
+        }
+        build();
+        return true;
+    }
+
+  private:
+    // the searcher for the first bytes and literals
+    void build()
+    {
+        kind = Kind::BYTES;
+        reach = 1;
+        nfirst = 0;
+        rare.clear();
+        for (int c = 0; c < 256; ++c)
+        {
+            nfirst += first[c];
+            if (first[c] && nfirst <= MAX_RARE)
+            {
+                rare += static_cast<char>(c);
+            }
+        }
+        if (nfirst > MAX_RARE)
+        {
+            rare.clear();
+        }
+
+        auto shortest = MAX_LENGTH;
+        prefix = literals.size() ? literals[0] : "";
+        for (auto &literal: literals)
+        {
+            shortest = std::min(shortest, literal.size());
+            prefix.resize(std::mismatch(prefix.begin(), prefix.end(), literal.begin(), literal.end()).first
+                - prefix.begin());
+        }
+        if (shortest < 2)
+        {
+            return;
+        }
+
+        // literals that share their first bytes, or begin with a few rare ones, are
+        // found as fast by memchr for those as by a search for all of them, where
+        // they fan out from one first byte as in x[a-c]z or x.*z much faster; a
+        // single literal is its own prefix, so Teddy and Aho-Corasick get several
+        if (prefix.size() > 1)
+        {
+            kind = Kind::LITERAL;
+            reach = prefix.size();
+            return;
+        }
+        if (rare.size())
+        {
+            return;
+        }
+
+        for (auto &literal: literals)
+        {
+            reach = std::max(reach, literal.size());
+        }
+        if (literals.size() <= Teddy::MAX_LITERALS)
+        {
+            kind = Kind::TEDDY;
+            teddy = Teddy(literals);
+        }
+        else
+        {
+            kind = Kind::AHO_CORASICK;
+            aho_corasick = AhoCorasick(literals);
+        }
+    }
+
+  public:
+    bool active() const
+    {
+        return kind != Kind::BYTES || nfirst < 256;
+    }
+
+    // every match begins with a literal and every literal is a match, so the leftmost
+    // match starts at the first position found that the forward automaton matches from
+    bool exact() const
+    {
+        return complete;
+    }
+
+    // the input next needs past a position to tell whether a match may start there
+    std::size_t width() const
+    {
+        return reach;
+    }
+
+    // the first position at or after from where a match may start, or size
+    std::size_t next(const unsigned char *data, std::size_t size, std::size_t from) const
+    {
+        switch (kind)
+        {
+        case Kind::LITERAL:
+        {
+            auto lead = static_cast<unsigned char>(prefix[0]);
+            while (from + prefix.size() <= size)
+            {
+                auto at = static_cast<const unsigned char *>(std::memchr(data + from, lead, size - from));
+                if (!at || at - data + prefix.size() > size)
+                {
+                    break;
+                }
+                from = at - data;
+                if (!std::memcmp(at, prefix.data(), prefix.size()))
+                {
+                    return from;
+                }
+                ++from;
+            }
+            return size;
+        }
+        case Kind::TEDDY:
+            return teddy.find(data, size, from);
+        case Kind::AHO_CORASICK:
+            return aho_corasick.find(data, size, from);
+        default:
+            break;
+        }
+
+        if (rare.size())
+        {
+            auto limit = size;
+            for (auto c: rare)
+            {
+                auto at = static_cast<const unsigned char *>(std::memchr(data + from, c, limit - from));
+                if (at)
+                {
+                    limit = at - data;
+                }
+            }
+            return limit;
+        }
+
+        while (from < size && !first[data[from]])
+        {
+            ++from;
+        }
+        return from;
+    }
+
+    // the bytes of the literals and the searchers built from them
+    std::size_t bytes() const
+    {
+        std::size_t res = rare.capacity() + teddy.bytes() + aho_corasick.bytes();
+        for (auto &literal: literals)
+        {
+            res += sizeof(std::string) + literal.capacity();
+        }
+        return res;
+    }
+};
+
+// positions of [lo, hi) known to start a match that ends at or before hi, it lets
+// consecutive finds over one input share the reverse scan
+class StartCache
+{
+  public:
+    std::size_t lo, hi;
+    std::vector<bool> starts;
+
+    StartCache() : lo(0), hi(0) {}
+};
+
+// the automata a pattern searches with, all of them accept nonempty words only:
+// forward is anchored at the match start, unanchored may start anywhere and
+// reverse runs backwards from the match end, unanchored unless end is set;
+// they are not changed by matching, whatever a scan fills in goes to its Caches
+template <typename Automaton>
+class Automata
+{
+  public:
+    static constexpr std::size_t npos = -1;
+
+    class Caches
+    {
+      public:
+        typename Automaton::Cache forward, unanchored, reverse;
+        // the caller's caches of lazy_unanchored and lazy_reverse, when there are those
+        LazyDFA::Cache *lazy_unanchored, *lazy_reverse;
+
+        Caches() : lazy_unanchored(nullptr), lazy_reverse(nullptr) {}
+    };
+
+    // the unanchored and reverse automata may take up to this many states per state
+    // of forward, and this many more, before they are determinized while scanning
+    static constexpr std::size_t MAX_LOOPING = 16;
+
+    Automaton forward, unanchored, reverse;
+    // the unanchored and reverse automata determinized while scanning, in place of
+    // those build gave up on, which are then left empty
+    std::optional<LazyDFA> lazy_unanchored, lazy_reverse;
+    Prefilter prefilter;
+    bool begin, end;
+
+    Automata() : begin(false), end(false) {}
+
+    // build(nfa, limit) is the automaton of nfa, or nothing when it takes more than
+    // limit states, unless that is 0; forward is built first and without a limit,
+    // when it cannot be built nothing else is; a lazy automaton gets a cache of
+    // capacity bytes
+    template <typename Build>
+    Automata(const NFA &nfa, bool begin, bool end, Build build, std::size_t capacity) : begin(begin), end(end)
+    {
+        auto words = nfa.nonempty();
+        auto res = build(words, 0);
+        if (!res)
+        {
+            return;
+        }
+        forward = std::move(*res);
+        if (!begin && !end)
+        {
+            prefilter = Prefilter(words);
+        }
+        // the first position an exact prefilter finds that a match starts from starts
+        // the leftmost match, no other automaton is needed to search
+        if (!begin && !prefilter.exact())
+        {
+            // the threads the unanchored automata start at every position may take
+            // a state per set of them alive, as in b.{0,20}a, and the reverse
+            // automaton of an unanchored search is unanchored too
+            std::size_t limit = 0;
+            if constexpr (std::is_same<Automaton, DFA>::value)
+            {
+                limit = MAX_LOOPING * (forward.accept.size() + MAX_LOOPING);
+            }
+            auto reversed = words.reversed();
+            auto backward = end ? reversed : reversed.unanchored(false);
+            res = build(backward, limit);
+            if (res)
+            {
+                reverse = std::move(*res);
+            }
+            else
+            {
+                lazy_reverse = LazyDFA(backward, capacity);
+            }
+            if (!end)
+            {
+                auto looping = words.unanchored();
+                res = build(looping, limit);
+                if (res)
+                {
+                    unanchored = std::move(*res);
+                }
+                else
+                {
+                    lazy_unanchored = LazyDFA(looping, capacity);
+                }
+            }
+        }
+    }
+
+    // whether every automaton is a table, which can be saved or compiled
+    bool tables() const
+    {
+        return !lazy_unanchored && !lazy_reverse;
+    }
+
+    void save(Writer &out) const
+    {
+        out.u32(begin | end << 1);
+        forward.save(out);
+        unanchored.save(out);
+        reverse.save(out);
+        prefilter.save(out);
+    }
+
+    bool load(Reader &in)
+    {
+        auto flags = in.u32();
+        begin = flags & 1;
+        end = flags & 2;
+        return forward.load(in) && unanchored.load(in) && reverse.load(in) && prefilter.load(in);
+    }
+
+    std::size_t bytes() const
+    {
+        return forward.bytes() + unanchored.bytes() + reverse.bytes() + prefilter.bytes()
+            + (lazy_unanchored ? lazy_unanchored->bytes() : 0) + (lazy_reverse ? lazy_reverse->bytes() : 0);
+    }
+
+    // end of the longest match starting at at, or npos; alive is set when the
+    // scan reaches size with the match still under way
+    std::size_t longest(const unsigned char *data, std::size_t size, std::size_t at, Caches &scratch,
+        bool *alive = nullptr) const
+    {
+        auto &&forward = this->forward.bind(scratch.forward);
+        auto state = forward.start;
+        std::size_t res = npos;
+
+        for (auto i = at; i < size; ++i)
+        {
+            state = forward.next(state, data[i]);
+            if (state == Automaton::DEAD)
+            {
+                return end ? npos : res;
+            }
+
+            if (forward.accept[state])
+            {
+                res = i + 1;
+            }
+        }
+        if (alive)
+        {
+            *alive = true;
+        }
+        return end ? (forward.accept[state] ? size : npos) : res;
+    }
+
+    // calls scan with the reverse automaton bound to its cache
+    template <typename Scan>
+    void backward(Caches &scratch, Scan &&scan) const
+    {
+        if (lazy_reverse)
+        {
+            scan(lazy_reverse->bind(*scratch.lazy_reverse));
+        }
+        else
+        {
+            scan(reverse.bind(scratch.reverse));
+        }
+    }
+
+    // the scan of find over the unanchored automaton: the earliest end of any match, then
+    // the threads under way die out; lo is where the first of them started and hi where
+    // the last died, no match starting before the earliest end ends beyond it
+    template <typename Unanchored>
+    bool earliest(Unanchored &&unanchored, const unsigned char *data, std::size_t size, std::size_t from,
+        std::size_t limit, std::size_t bound, std::size_t last, std::size_t &lo, std::size_t &hi, bool *settled) const
+    {
+        constexpr auto DEAD = std::decay_t<Unanchored>::DEAD;
+
+        // the earliest end of any match, while no match is under way
+        // the prefilter skips to the next position one may start at,
+        // no thread is started from limit on
+        auto p = from;
+        lo = from;
+        auto state = unanchored.start;
+        bool stopped = false;
+        while (p < last && !unanchored.accept[state])
+        {
+            if (p == limit && !stopped)
+            {
+                state = unanchored.stop(state);
+                stopped = true;
+            }
+            if (stopped)
+            {
+                if (state == DEAD)
+                {
+                    return false;
+                }
+            }
+            else if (state == unanchored.start && prefilter.active())
+            {
+                auto at = prefilter.next(data, bound, p);
+                if (at != p)
+                {
+                    // every thread alive at p died on the skipped bytes
+                    if (at >= limit)
+                    {
+                        return false;
+                    }
+                    p = lo = at;
+                }
+            }
+            state = unanchored.next(state, data[p++]);
+        }
+        if (!unanchored.accept[state])
+        {
+            // the threads alive at the end of the scan may still match past it
+            if (last < size && (stopped ? state : unanchored.stop(state)) != DEAD && settled)
+            {
+                *settled = false;
+            }
+            return false;
+        }
+
+        // stop starting new threads and let the ones started so far die out,
+        // no match starting before here ends beyond hi
+        if (!stopped)
+        {
+            state = unanchored.stop(state);
+        }
+        while (p < last && state != DEAD)
+        {
+            state = unanchored.next(state, data[p++]);
+        }
+        if (state != DEAD && last < size)
+        {
+            if (settled)
+            {
+                *settled = false;
+            }
+            return false;
+        }
+        hi = p;
+        return true;
+    }
+
+    // the leftmost-longest match starting at or after from and before limit,
+    // which may end beyond limit; the scans stop at until, no earlier than limit,
+    // and when the match, or that there is none, depends on the input past it
+    // settled is cleared and nothing is found
+    bool find(const unsigned char *data, std::size_t size, std::size_t from, std::size_t limit,
+        std::size_t &match_begin, std::size_t &match_end, Caches &scratch, StartCache *cache = nullptr,
+        std::size_t until = npos, bool *settled = nullptr) const
+    {
+        if (begin)
+        {
+            match_begin = 0;
+            match_end = from || !limit ? npos : longest(data, size, 0, scratch);
+            return match_end != npos;
+        }
+
+        if (end)
+        {
+            match_begin = npos;
+            backward(scratch, [&](auto &&reverse)
+            {
+                auto state = reverse.start;
+                for (auto p = size; p > from; )
+                {
+                    state = reverse.next(state, data[--p]);
+                    if (state == std::decay_t<decltype(reverse)>::DEAD)
+                    {
+                        break;
+                    }
+                    if (reverse.accept[state])
+                    {
+                        match_begin = p;
+                    }
+                }
+            });
+            match_end = size;
+            return match_begin < limit;
+        }
+
+        // a match starting before limit begins with a literal inside of bound
+        auto bound = limit < size ? std::min(size, limit + prefilter.width() - 1) : size;
+        auto last = std::min(size, until);
+        auto unsettle = [&]
+        {
+            if (settled)
+            {
+                *settled = false;
+            }
+            return false;
+        };
+
+        if (prefilter.exact())
+        {
+            for (auto p = prefilter.next(data, bound, from); p < limit; p = prefilter.next(data, bound, p + 1))
+            {
+                bool alive = false;
+                match_end = longest(data, last, p, scratch, &alive);
+                if (alive && last < size)
+                {
+                    return unsettle();
+                }
+                if (match_end != npos)
+                {
+                    match_begin = p;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::size_t lo, hi;
+        if (!(lazy_unanchored
+            ? earliest(lazy_unanchored->bind(*scratch.lazy_unanchored), data, size, from, limit, bound, last, lo, hi,
+                settled)
+            : earliest(this->unanchored.bind(scratch.unanchored), data, size, from, limit, bound, last, lo, hi,
+                settled)))
+        {
+            return false;
+        }
+
+        // the leftmost start is the last accepting position of a backward scan from hi
+        StartCache local;
+        if (!cache)
+        {
+            cache = &local;
+        }
+        if (lo < cache->lo || hi > cache->hi || cache->starts.empty())
+        {
+            cache->lo = lo;
+            cache->hi = hi;
+            cache->starts.assign(hi - lo, false);
+            backward(scratch, [&](auto &&reverse)
+            {
+                auto state = reverse.start;
+                for (auto p = hi; p > lo; )
+                {
+                    state = reverse.next(state, data[--p]);
+                    cache->starts[p - lo] = reverse.accept[state];
+                }
+            });
+        }
+
+        for (match_begin = lo; !cache->starts[match_begin - cache->lo]; ++match_begin);
+        match_end = longest(data, size, match_begin, scratch);
+        return true;
+    }
+};
+
+#ifdef CRE_JIT
+// x86-64 machine code for the automata of a pattern: every dfa state is a block that
+// loads the next byte, compares it against the ranges leaving the state, or looks it
+// up in a jump table when there are many, and jumps to the block of the target, so
+// the current state is the instruction pointer and accept checks are inline; it finds
+// the matches Automata::find does over a whole input, with the prefilter left in C++
+class Jit
+{
+  public:
+    static constexpr std::size_t npos = -1;
+    // no code is generated for a dfa of more states, its pattern keeps the tables
+    static constexpr std::size_t MAX_STATES = 4096;
+    // a block with more ranges leaving it dispatches through a jump table
+    static constexpr std::size_t MAX_COMPARES = 4;
+
+  private:
+    // how earliest returned
+    enum Exit
+    {
+        NONE,
+        FOUND,
+        START
+    };
+
+    // end of the longest match from p, or null
+    using Longest = const unsigned char *(*)(const unsigned char *p, const unsigned char *last);
+    // the start of the last accepting state scanning backwards from p down to first, or null
+    using Backward = const unsigned char *(*)(const unsigned char *p, const unsigned char *first);
+    // the unanchored scan from p, see Automata::find; on FOUND hi is where the threads
+    // under way died out, on START the scan returned to its start state at hi
+    using Earliest = int (*)(const unsigned char *p, const unsigned char *last, const unsigned char **hi);
+
+    // code with labels bound to its offsets, jumps to them are patched by link
+    class Assembler
+    {
+      public:
+        std::vector<unsigned char> code;
+        std::vector<std::size_t> labels;
+        // rel32 fields, relative to their end, and jump table entries, relative to the table
+        std::vector<std::pair<std::size_t, std::size_t>> jumps;
+        std::vector<std::tuple<std::size_t, std::size_t, std::size_t>> entries;
+        // the label of a jump table and the labels of its 256 targets, emitted after the code
+        std::vector<std::pair<std::size_t, std::vector<std::size_t>>> tables;
+
+        std::size_t label()
+        {
+            labels.push_back(npos);
+            return labels.size() - 1;
+        }
+
+        void bind(std::size_t label)
+        {
+            labels[label] = code.size();
+        }
+
+        void emit(std::initializer_list<unsigned char> bytes)
+        {
+            code.insert(code.end(), bytes);
+        }
+
+        void u32(std::uint32_t value)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                code.push_back(static_cast<unsigned char>(value >> (8 * i)));
+            }
+        }
+
+        // op followed by the rel32 of label
+        void jump(std::initializer_list<unsigned char> op, std::size_t label)
+        {
+            emit(op);
+            jumps.emplace_back(code.size(), label);
+            u32(0);
+        }
+
+        void link()
+        {
+            for (auto &table: tables)
+            {
+                while (code.size() % 4)
+                {
+                    code.push_back(0xcc);
+                }
+                bind(table.first);
+                for (auto target: table.second)
+                {
+                    entries.emplace_back(code.size(), target, table.first);
+                    u32(0);
+                }
+            }
+            auto patch = [&](std::size_t at, std::int64_t value)
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    code[at + i] = static_cast<unsigned char>(static_cast<std::uint64_t>(value) >> (8 * i));
+                }
+            };
+            for (auto &jump: jumps)
+            {
+                patch(jump.first, static_cast<std::int64_t>(labels[jump.second]) - static_cast<std::int64_t>(jump.first + 4));
+            }
+            for (auto &entry: entries)
+            {
+                patch(std::get<0>(entry), static_cast<std::int64_t>(labels[std::get<1>(entry)])
+                    - static_cast<std::int64_t>(labels[std::get<2>(entry)]));
+            }
+        }
+    };
+
+    // what the blocks of one scan do on entering a state, at the end of the input
+    // and on the dead state; the registers are rdi for the position, rsi for the
+    // end of the input, eax for the byte read and r8 for the result so far
+    class Hooks
+    {
+      public:
+        std::function<bool(Assembler &, std::uint32_t)> enter;
+        std::function<std::size_t(std::uint32_t)> at_end;
+        std::size_t dead;
+    };
+
+    void *code;
+    std::size_t size;
+    Longest longest_code;
+    Backward backward_code;
+    Earliest earliest_code;
+
+    // the live states reachable from entries
+    static std::vector<std::uint32_t> reachable(const DFA &dfa, const std::vector<std::uint32_t> &entries)
+    {
+        std::vector<bool> seen(dfa.accept.size());
+        std::vector<std::uint32_t> res;
+        auto visit = [&](std::uint32_t state)
+        {
+            if (state != DFA::DEAD && !seen[state])
+            {
+                seen[state] = true;
+                res.push_back(state);
+            }
+        };
+        for (auto state: entries)
+        {
+            visit(state);
+        }
+        for (std::size_t i = 0; i < res.size(); ++i)
+        {
+            for (std::size_t c = 0; c < dfa.classes.size(); ++c)
+            {
+                visit(dfa.table[res[i] * dfa.stride + c]);
+            }
+        }
+        return res;
+    }
+
+    // the block of state at label, which jumps to labels[target] or the dead hook;
+    // a block whose enter hook ends it is not given the rest
+    static void block(Assembler &as, const DFA &dfa, std::uint32_t state, std::size_t label,
+        const std::vector<std::size_t> &labels, const Hooks &hooks, bool enter, bool reverse)
+    {
+        as.bind(label);
+        if (enter && hooks.enter(as, state))
+        {
+            return;
+        }
+        as.emit({0x48, 0x39, 0xf7});                        // cmp rdi, rsi
+        as.jump({0x0f, 0x84}, hooks.at_end(state));         // je at_end
+        if (reverse)
+        {
+            as.emit({0x48, 0xff, 0xcf});                    // dec rdi
+            as.emit({0x0f, 0xb6, 0x07});                    // movzx eax, byte [rdi]
+        }
+        else
+        {
+            as.emit({0x0f, 0xb6, 0x07});                    // movzx eax, byte [rdi]
+            as.emit({0x48, 0xff, 0xc7});                    // inc rdi
+        }
+
+        auto target = [&](int c)
+        {
+            auto next = dfa.next(state, static_cast<unsigned char>(c));
+            return next == DFA::DEAD ? hooks.dead : labels[next];
+        };
+        std::vector<std::tuple<int, int, std::size_t>> ranges;
+        for (int c = 0; c < 256; ++c)
+        {
+            auto to = target(c);
+            if (to == hooks.dead)
+            {
+                continue;
+            }
+            if (!ranges.empty() && std::get<1>(ranges.back()) == c - 1 && std::get<2>(ranges.back()) == to)
+            {
+                std::get<1>(ranges.back()) = c;
+            }
+            else
+            {
+                ranges.emplace_back(c, c, to);
+            }
+        }
+
+        if (ranges.size() <= MAX_COMPARES)
+        {
+            for (auto &range: ranges)
+            {
+                auto lo = std::get<0>(range), hi = std::get<1>(range);
+                if (lo == hi)
+                {
+                    as.emit({0x3d});                        // cmp eax, lo
+                    as.u32(lo);
+                    as.jump({0x0f, 0x84}, std::get<2>(range));
+                }
+                else
+                {
+                    as.emit({0x41, 0x89, 0xc1});            // mov r9d, eax
+                    as.emit({0x41, 0x81, 0xe9});            // sub r9d, lo
+                    as.u32(lo);
+                    as.emit({0x41, 0x81, 0xf9});            // cmp r9d, hi - lo
+                    as.u32(hi - lo);
+                    as.jump({0x0f, 0x86}, std::get<2>(range));  // jbe target
+                }
+            }
+            as.jump({0xe9}, hooks.dead);
+            return;
+        }
+
+        std::vector<std::size_t> targets(256);
+        for (int c = 0; c < 256; ++c)
+        {
+            targets[c] = target(c);
+        }
+        auto table = as.label();
+        as.tables.emplace_back(table, std::move(targets));
+        as.jump({0x4c, 0x8d, 0x0d}, table);                 // lea r9, [rip + table]
+        as.emit({0x49, 0x63, 0x04, 0x81});                  // movsxd rax, dword [r9 + rax * 4]
+        as.emit({0x4c, 0x01, 0xc8});                        // add rax, r9
+        as.emit({0xff, 0xe0});                              // jmp rax
+    }
+
+    // the blocks of the states reachable from entries, the first entry first so
+    // that the code before falls through into it, or jumps to the dead hook
+    static void blocks(Assembler &as, const DFA &dfa, const std::vector<std::uint32_t> &entries,
+        const Hooks &hooks, bool reverse)
+    {
+        std::vector<std::size_t> labels(dfa.accept.size(), npos);
+        auto states = reachable(dfa, entries);
+        if (states.empty())
+        {
+            as.jump({0xe9}, hooks.dead);
+        }
+        for (auto state: states)
+        {
+            labels[state] = as.label();
+        }
+        for (auto state: states)
+        {
+            block(as, dfa, state, labels[state], labels, hooks, true, reverse);
+        }
+    }
+
+    static void ret(Assembler &as, std::size_t label, std::initializer_list<unsigned char> result)
+    {
+        as.bind(label);
+        as.emit(result);
+        as.emit({0xc3});                                    // ret
+    }
+
+    // longest over the forward dfa, see Automata::longest
+    static void emit_longest(Assembler &as, const DFA &dfa, bool end)
+    {
+        auto res = as.label(), at = as.label(), none = as.label();
+        Hooks hooks;
+        hooks.enter = [&](Assembler &as, std::uint32_t state)
+        {
+            if (dfa.accept[state] && !end)
+            {
+                as.emit({0x49, 0x89, 0xf8});                // mov r8, rdi
+            }
+            return false;
+        };
+        hooks.at_end = [&](std::uint32_t state)
+        {
+            return !end ? res : dfa.accept[state] ? at : none;
+        };
+        hooks.dead = end ? none : res;
+
+        as.emit({0x45, 0x31, 0xc0});                        // xor r8d, r8d
+        blocks(as, dfa, {dfa.start}, hooks, false);
+        ret(as, res, {0x4c, 0x89, 0xc0});                   // mov rax, r8
+        ret(as, at, {0x48, 0x89, 0xf8});                    // mov rax, rdi
+        ret(as, none, {0x31, 0xc0});                        // xor eax, eax
+    }
+
+    // the last accepting state of a backward scan, the leftmost match start
+    static void emit_backward(Assembler &as, const DFA &dfa)
+    {
+        auto res = as.label();
+        Hooks hooks;
+        hooks.enter = [&](Assembler &as, std::uint32_t state)
+        {
+            if (dfa.accept[state])
+            {
+                as.emit({0x49, 0x89, 0xf8});                // mov r8, rdi
+            }
+            return false;
+        };
+        hooks.at_end = [&](std::uint32_t) { return res; };
+        hooks.dead = res;
+
+        as.emit({0x45, 0x31, 0xc0});                        // xor r8d, r8d
+        blocks(as, dfa, {dfa.start}, hooks, true);
+        ret(as, res, {0x4c, 0x89, 0xc0});                   // mov rax, r8
+    }
+
+    // the earliest end of a match over the unanchored dfa, then on the stop symbol
+    // the threads under way die out; rdx holds hi, with prefilter the scan returns
+    // in its start state for the prefilter to skip ahead
+    static void emit_earliest(Assembler &as, const DFA &dfa, bool prefilter)
+    {
+        auto none = as.label(), hi = as.label(), start = as.label();
+
+        Hooks dying;
+        dying.enter = [](Assembler &, std::uint32_t) { return false; };
+        dying.at_end = [&](std::uint32_t) { return hi; };
+        dying.dead = hi;
+
+        std::vector<std::uint32_t> stops;
+        std::vector<std::size_t> stopped(dfa.accept.size(), npos);
+        Hooks scan;
+        scan.enter = [&](Assembler &as, std::uint32_t state)
+        {
+            if (dfa.accept[state])
+            {
+                auto stop = dfa.stop(state);
+                as.jump({0xe9}, stop == DFA::DEAD ? hi : stopped[stop]);
+                return true;
+            }
+            if (state == dfa.start && prefilter)
+            {
+                as.emit({0x48, 0x89, 0x3a});                // mov [rdx], rdi
+                as.emit({0xb8});                            // mov eax, START
+                as.u32(START);
+                as.emit({0xc3});                            // ret
+                return true;
+            }
+            return false;
+        };
+        scan.at_end = [&](std::uint32_t) { return none; };
+        scan.dead = none;
+
+        auto states = reachable(dfa, {dfa.start});
+        for (auto state: states)
+        {
+            if (dfa.accept[state])
+            {
+                stops.push_back(dfa.stop(state));
+            }
+        }
+        auto dying_states = reachable(dfa, stops);
+        for (auto state: dying_states)
+        {
+            stopped[state] = as.label();
+        }
+
+        std::vector<std::size_t> labels(dfa.accept.size(), npos);
+        for (auto state: states)
+        {
+            labels[state] = as.label();
+        }
+        // the start state is entered without its hook, the scan consumes a byte first
+        if (dfa.start == DFA::DEAD)
+        {
+            as.jump({0xe9}, none);
+        }
+        else
+        {
+            block(as, dfa, dfa.start, start, labels, scan, false, false);
+        }
+        for (auto state: states)
+        {
+            block(as, dfa, state, labels[state], labels, scan, true, false);
+        }
+        for (auto state: dying_states)
+        {
+            block(as, dfa, state, stopped[state], stopped, dying, true, false);
+        }
+
+        as.bind(hi);
+        as.emit({0x48, 0x89, 0x3a});                        // mov [rdx], rdi
+        as.emit({0xb8});                                    // mov eax, FOUND
+        as.u32(FOUND);
+        as.emit({0xc3});                                    // ret
+        ret(as, none, {0x31, 0xc0});                        // xor eax, eax
+    }
+
+  public:
+    // the code of automata, or null where it cannot be generated or mapped or
+    // one of them is determinized while scanning
+    static std::unique_ptr<Jit> compile(const Automata<DFA> &automata)
+    {
+        auto reverse = !automata.begin && !automata.prefilter.exact();
+        auto unanchored = reverse && !automata.end;
+        if (!automata.tables())
+        {
+            return nullptr;
+        }
+        for (auto dfa: {&automata.forward, &automata.unanchored, &automata.reverse})
+        {
+            if (dfa->accept.size() > MAX_STATES)
+            {
+                return nullptr;
+            }
+        }
+
+        Assembler as;
+        auto longest_at = as.code.size();
+        emit_longest(as, automata.forward, automata.end);
+        auto backward_at = as.code.size();
+        if (reverse)
+        {
+            emit_backward(as, automata.reverse);
+        }
+        auto earliest_at = as.code.size();
+        if (unanchored)
+        {
+            emit_earliest(as, automata.unanchored, automata.prefilter.active());
+        }
+        as.link();
+
+        auto code = ::mmap(nullptr, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        std::memcpy(code, as.code.data(), as.code.size());
+        if (::mprotect(code, as.code.size(), PROT_READ | PROT_EXEC))
+        {
+            ::munmap(code, as.code.size());
+            return nullptr;
+        }
+
+        auto res = std::unique_ptr<Jit>(new Jit());
+        auto base = static_cast<unsigned char *>(code);
+        res->code = code;
+        res->size = as.code.size();
+        res->longest_code = reinterpret_cast<Longest>(base + longest_at);
+        res->backward_code = reverse ? reinterpret_cast<Backward>(base + backward_at) : nullptr;
+        res->earliest_code = unanchored ? reinterpret_cast<Earliest>(base + earliest_at) : nullptr;
+        return res;
+    }
+
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+
+    ~Jit()
+    {
+        ::munmap(code, size);
+    }
+
+    // end of the longest match starting at at, or npos
+    std::size_t longest(const unsigned char *data, std::size_t size, std::size_t at) const
+    {
+        auto end = longest_code(data + at, data + size);
+        return end ? end - data : npos;
+    }
+
+    // the leftmost-longest match starting at or after from, see Automata::find
+    // with limit at the end of the input
+    bool find(const Automata<DFA> &automata, const unsigned char *data, std::size_t size, std::size_t from,
+        std::size_t &match_begin, std::size_t &match_end) const
+    {
+        auto &prefilter = automata.prefilter;
+        if (automata.begin)
+        {
+            match_begin = 0;
+            match_end = from || !size ? npos : longest(data, size, 0);
+            return match_end != npos;
+        }
+
+        if (automata.end)
+        {
+            auto begin = backward_code(data + size, data + from);
+            match_begin = begin ? begin - data : npos;
+            match_end = size;
+            return begin;
+        }
+
+        if (prefilter.exact())
+        {
+            for (auto p = prefilter.next(data, size, from); p < size; p = prefilter.next(data, size, p + 1))
+            {
+                match_end = longest(data, size, p);
+                if (match_end != npos)
+                {
+                    match_begin = p;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // the prefilter skips to the next position a match may start at whenever
+        // the scan is back in its start state
+        const unsigned char *hi;
+        auto p = from, lo = from;
+        for (;;)
+        {
+            if (prefilter.active())
+            {
+                auto at = prefilter.next(data, size, p);
+                if (at != p)
+                {
+                    // every thread alive at p died on the skipped bytes
+                    if (at >= size)
+                    {
+                        return false;
+                    }
+                    p = lo = at;
+                }
+            }
+            auto exit = earliest_code(data + p, data + size, &hi);
+            if (exit == NONE)
+            {
+                return false;
+            }
+            if (exit == FOUND)
+            {
+                break;
+            }
+            p = hi - data;
+        }
+
+        match_begin = backward_code(hi, data + lo) - data;
+        match_end = longest(data, size, match_begin);
+        return true;
+    }
+
+    // the bytes of the machine code
+    std::size_t bytes() const
+    {
+        return size;
+    }
+
+  private:
+    Jit() : code(nullptr), size(0), longest_code(nullptr), backward_code(nullptr), earliest_code(nullptr) {}
+};
+#endif
+
+// the groups of a match the automata found, by a pike vm over the nfa that runs on
+// the match only: the threads advance in lockstep in order of priority, the earlier
+// branch of an alternation and one more round of a repetition first, and the first
+// to reach the end of the nfa at the end of the match tells where every group was;
+// a thread in a COUNT state carries the rounds it took, threads in one state after
+// as many rounds are one, as those in the states of the rounds written out would be
+class Captures
+{
+  public:
+    static constexpr std::size_t npos = -1;
+
+  private:
+    // a state to enter, a COUNT state after rounds rounds, or with state NONE
+    // the value to restore slot to
+    class Frame
+    {
+      public:
+        std::uint32_t state, slot, rounds;
+        std::size_t value;
+
+        Frame(std::uint32_t state, std::uint32_t slot = 0, std::size_t value = 0, std::uint32_t rounds = 0)
+          : state(state), slot(slot), rounds(rounds), value(value) {}
+    };
+
+    // the threads at one position in order of priority, with the slots of each in a row
+    class Threads
+    {
+      public:
+        std::vector<std::uint32_t> states, rounds;
+        std::vector<std::size_t> slots;
+    };
+
+    std::vector<NFAState> states;
+    std::vector<std::bitset<256>> sets;
+    std::vector<Repeat> repeats;
+    std::uint32_t start, end;
+    std::size_t slots;
+
+    // the threads reached from state, a COUNT state after rounds rounds, through epsilon
+    // edges, with caps as the slots once the ones passed record pos; a state marked with
+    // stamp, or a COUNT state in counted after as many rounds, is added already
+    void add(Threads &threads, std::uint32_t state, std::uint32_t rounds, std::vector<std::size_t> &caps,
+        std::size_t pos, std::vector<std::size_t> &mark, std::size_t stamp,
+        std::set<std::pair<std::uint32_t, std::uint32_t>> &counted, std::vector<Frame> &stack) const
+    {
+        stack.assign(1, Frame(state, 0, 0, rounds));
+        while (!stack.empty())
+        {
+            auto frame = stack.back();
+            stack.pop_back();
+            if (frame.state == NFAState::NONE)
+            {
+                caps[frame.slot] = frame.value;
+                continue;
+            }
+
+            auto &s = states[frame.state];
+            if (s.edge_type == NFAState::EdgeType::COUNT)
+            {
+                // one more round first, then from min on leaving
+                auto &repeat = repeats[s.repeat];
+                if (!counted.emplace(frame.state, frame.rounds).second)
+                {
+                    continue;
+                }
+                if (frame.rounds < repeat.max)
+                {
+                    threads.states.push_back(frame.state);
+                    threads.rounds.push_back(frame.rounds);
+                    threads.slots.insert(threads.slots.end(), caps.begin(), caps.end());
+                }
+                if (frame.rounds >= repeat.min)
+                {
+                    stack.emplace_back(s.next);
+                }
+                continue;
+            }
+            if (mark[frame.state] == stamp)
+            {
+                continue;
+            }
+            mark[frame.state] = stamp;
+
+            if (s.save != NFAState::NONE)
+            {
+                stack.emplace_back(NFAState::NONE, s.save, caps[s.save]);
+                caps[s.save] = pos;
+            }
+            if (s.edge_type == NFAState::EdgeType::EPSILON)
+            {
+                if (s.next2 != NFAState::NONE)
+                {
+                    stack.emplace_back(s.next2);
+                }
+                stack.emplace_back(s.next);
+            }
+            else if (s.edge_type == NFAState::EdgeType::CCL || frame.state == end)
+            {
+                threads.states.push_back(frame.state);
+                threads.rounds.push_back(0);
+                threads.slots.insert(threads.slots.end(), caps.begin(), caps.end());
+            }
+        }
+    }
+
+  public:
+    Captures() : start(NFAState::NONE), end(NFAState::NONE), slots(0) {}
+    Captures(const NFA &nfa, std::size_t groups)
+      : states(nfa.states), sets(nfa.sets), repeats(nfa.repeats), start(nfa.start), end(nfa.end),
+        slots(2 * groups) {}
+
+    std::size_t groups() const
+    {
+        return slots / 2;
+    }
+
+    // the begin and end of every group in the match [begin, finish) of data, npos
+    // for a group that took no part in it, or nothing if it is not a match
+    std::vector<std::size_t> run(const unsigned char *data, std::size_t begin, std::size_t finish) const
+    {
+        std::vector<std::size_t> caps(slots, npos), mark(states.size(), 0);
+        std::set<std::pair<std::uint32_t, std::uint32_t>> counted;
+        std::vector<Frame> stack;
+        Threads now, next;
+        std::size_t stamp = 1;
+        add(now, start, 0, caps, begin, mark, stamp, counted, stack);
+
+        for (auto pos = begin; pos < finish && !now.states.empty(); ++pos)
+        {
+            ++stamp;
+            counted.clear();
+            next.states.clear();
+            next.rounds.clear();
+            next.slots.clear();
+            for (std::size_t i = 0; i < now.states.size(); ++i)
+            {
+                auto &s = states[now.states[i]];
+                if ((s.edge_type != NFAState::EdgeType::CCL && s.edge_type != NFAState::EdgeType::COUNT)
+                    || !sets[s.input_set][data[pos]])
+                {
+                    continue;
+                }
+                std::copy(now.slots.begin() + i * slots, now.slots.begin() + (i + 1) * slots, caps.begin());
+                if (s.edge_type == NFAState::EdgeType::COUNT)
+                {
+                    // the rounds of {n,} stop counting at n, any more are as many
+                    auto &repeat = repeats[s.repeat];
+                    auto rounds = repeat.max == Repeat::UNBOUNDED
+                        ? std::min(now.rounds[i] + 1, repeat.min)
+                        : now.rounds[i] + 1;
+                    add(next, now.states[i], rounds, caps, pos + 1, mark, stamp, counted, stack);
+                }
+                else
+                {
+                    add(next, s.next, 0, caps, pos + 1, mark, stamp, counted, stack);
+                }
+            }
+            std::swap(now, next);
+        }
+
+        for (std::size_t i = 0; i < now.states.size(); ++i)
+        {
+            if (now.states[i] == end)
+            {
+                std::vector<std::size_t> res(now.slots.begin() + i * slots, now.slots.begin() + (i + 1) * slots);
+                res[0] = begin;
+                res[1] = finish;
+                return res;
+            }
+        }
+        return {};
+    }
+
+    std::size_t bytes() const
+    {
+        return states.size() * sizeof(NFAState) + sets.size() * sizeof(std::bitset<256>)
+            + repeats.size() * sizeof(Repeat);
+    }
+};
+
+// the nfa run over the input without determinizing it: of the threads in a state only
+// the earliest start is kept, the only one a leftmost-longest match can come from, and
+// a COUNT state keeps its threads by the position they entered at, so a repetition is
+// one state and one step whatever its bounds; it takes more work per byte than a dfa,
+// but there is nothing to determinize, however the repetitions would blow a dfa up
+class Simulation
+{
+  public:
+    static constexpr std::size_t npos = -1;
+
+  private:
+    // a thread that entered a COUNT state at at, or is in a state with an input edge
+    class Thread
+    {
+      public:
+        std::size_t at, start;
+
+        Thread(std::size_t at, std::size_t start) : at(at), start(start) {}
+    };
+
+    // the threads in a COUNT state: the ones with too few rounds to leave in the order
+    // they entered, and of the ones that may leave those that started before every one
+    // entered after them, or for {n,} only the earliest start
+    class Counter
+    {
+      public:
+        std::deque<Thread> young, ripe;
+        std::size_t saturated;
+
+        Counter() : saturated(npos) {}
+
+        bool empty() const
+        {
+            return young.empty() && ripe.empty() && saturated == npos;
+        }
+
+        void clear()
+        {
+            young.clear();
+            ripe.clear();
+            saturated = npos;
+        }
+
+        void enter(std::size_t pos, std::size_t start)
+        {
+            if (!young.empty() && young.back().at == pos)
+            {
+                young.back().start = std::min(young.back().start, start);
+            }
+            else
+            {
+                young.emplace_back(pos, start);
+            }
+        }
+
+        // one more round up to pos for all threads, the earliest start of
+        // those that may leave after it, or npos
+        std::size_t step(std::size_t pos, const Repeat &repeat)
+        {
+            auto least = std::max<std::uint32_t>(repeat.min, 1);
+            while (!young.empty() && pos - young.front().at >= least)
+            {
+                auto thread = young.front();
+                young.pop_front();
+                if (repeat.max == Repeat::UNBOUNDED)
+                {
+                    saturated = std::min(saturated, thread.start);
+                    continue;
+                }
+                while (!ripe.empty() && ripe.back().start >= thread.start)
+                {
+                    ripe.pop_back();
+                }
+                ripe.push_back(thread);
+            }
+            while (!ripe.empty() && pos - ripe.front().at > repeat.max)
+            {
+                ripe.pop_front();
+            }
+            return repeat.max == Repeat::UNBOUNDED ? saturated : ripe.empty() ? npos : ripe.front().start;
+        }
+
+        // drops the threads started after start
+        void prune(std::size_t start)
+        {
+            auto later = [&](const Thread &thread)
+            {
+                return thread.start > start;
+            };
+            young.erase(std::remove_if(young.begin(), young.end(), later), young.end());
+            ripe.erase(std::remove_if(ripe.begin(), ripe.end(), later), ripe.end());
+            if (saturated > start)
+            {
+                saturated = npos;
+            }
+        }
+    };
+
+    // the threads at one position: the states with an input edge in now, with the
+    // state as at, and the COUNT states with any thread in counting; a state was
+    // reached at the position if its mark is stamp, from the start in start_of
+    class Scratch
+    {
+      public:
+        std::vector<Thread> now, next, leaving;
+        std::vector<std::uint32_t> counting, stack;
+        std::vector<std::size_t> mark, start_of, index_of;
+        std::vector<Counter> counters;
+        std::size_t stamp;
+
+        Scratch(std::size_t states, std::size_t repeats)
+          : mark(states, 0), start_of(states), index_of(states), counters(repeats), stamp(1) {}
+
+        bool alive() const
+        {
+            return !now.empty() || !counting.empty();
+        }
+    };
+
+    std::vector<NFAState> states;
+    std::vector<std::bitset<256>> sets;
+    std::vector<Repeat> repeats;
+    // the start and end states of the nfa
+    std::uint32_t start, final;
+    Prefilter prefilter;
+
+    // the threads reached from state through epsilon edges by a thread started at
+    // start, entering COUNT states at pos; a state reached from an earlier start
+    // already is left as it is
+    void reach(Scratch &scratch, std::uint32_t state, std::size_t start, std::size_t pos) const
+    {
+        auto &stack = scratch.stack;
+        stack.assign(1, state);
+        while (!stack.empty())
+        {
+            auto id = stack.back();
+            stack.pop_back();
+            auto first = scratch.mark[id] != scratch.stamp;
+            if (!first && scratch.start_of[id] <= start)
+            {
+                continue;
+            }
+            scratch.mark[id] = scratch.stamp;
+            scratch.start_of[id] = start;
+
+            auto &s = states[id];
+            if (s.edge_type == NFAState::EdgeType::EPSILON)
+            {
+                if (s.next2 != NFAState::NONE)
+                {
+                    stack.push_back(s.next2);
+                }
+                stack.push_back(s.next);
+            }
+            else if (s.edge_type == NFAState::EdgeType::CCL)
+            {
+                if (first)
+                {
+                    scratch.index_of[id] = scratch.next.size();
+                    scratch.next.emplace_back(id, start);
+                }
+                else
+                {
+                    scratch.next[scratch.index_of[id]].start = start;
+                }
+            }
+            else if (s.edge_type == NFAState::EdgeType::COUNT)
+            {
+                auto &counter = scratch.counters[s.repeat];
+                if (counter.empty())
+                {
+                    scratch.counting.push_back(id);
+                }
+                counter.enter(pos, start);
+                if (!repeats[s.repeat].min)
+                {
+                    stack.push_back(s.next);
+                }
+            }
+        }
+    }
+
+    // moves the threads from pos over c to pos + 1, but those started after last
+    void step(Scratch &scratch, std::size_t pos, unsigned char c, std::size_t last) const
+    {
+        ++scratch.stamp;
+        scratch.next.clear();
+
+        // the rounds of the COUNT states come before the threads entering them at pos + 1
+        auto &leaving = scratch.leaving;
+        leaving.clear();
+        std::size_t count = 0;
+        for (auto id: scratch.counting)
+        {
+            auto &s = states[id];
+            auto &counter = scratch.counters[s.repeat];
+            if (!sets[s.input_set][c])
+            {
+                counter.clear();
+                continue;
+            }
+            auto start = counter.step(pos + 1, repeats[s.repeat]);
+            if (start != npos)
+            {
+                leaving.emplace_back(s.next, start);
+            }
+            if (!counter.empty())
+            {
+                scratch.counting[count++] = id;
+            }
+        }
+        scratch.counting.resize(count);
+
+        for (auto &thread: scratch.now)
+        {
+            auto &s = states[thread.at];
+            if (thread.start <= last && sets[s.input_set][c])
+            {
+                reach(scratch, s.next, thread.start, pos + 1);
+            }
+        }
+        for (auto &thread: leaving)
+        {
+            if (thread.start <= last)
+            {
+                reach(scratch, static_cast<std::uint32_t>(thread.at), thread.start, pos + 1);
+            }
+        }
+        std::swap(scratch.now, scratch.next);
+    }
+
+    // the start of the match ending at pos that starts earliest, or npos
+    std::size_t accepted(const Scratch &scratch, std::size_t pos, std::size_t size) const
+    {
+        return scratch.mark[final] == scratch.stamp && scratch.start_of[final] < pos && (!end || pos == size)
+            ? scratch.start_of[final]
+            : npos;
+    }
+
+  public:
+    bool begin, end;
+
+    Simulation() : start(NFAState::NONE), final(NFAState::NONE), begin(false), end(false) {}
+
+    // prefilter tells where a match may start, it need not be exact
+    Simulation(const NFA &nfa, bool begin, bool end, const Prefilter &prefilter)
+      : states(nfa.states), sets(nfa.sets), repeats(nfa.repeats), start(nfa.start), final(nfa.end),
+        prefilter(prefilter), begin(begin), end(end) {}
+
+    // end of the longest match starting at at, or npos
+    std::size_t longest(const unsigned char *data, std::size_t size, std::size_t at) const
+    {
+        Scratch scratch(states.size(), repeats.size());
+        reach(scratch, start, at, at);
+        std::swap(scratch.now, scratch.next);
+
+        std::size_t res = npos;
+        for (auto pos = at; ; ++pos)
+        {
+            if (accepted(scratch, pos, size) != npos)
+            {
+                res = pos;
+            }
+            if (pos == size || !scratch.alive())
+            {
+                return res;
+            }
+            step(scratch, pos, data[pos], at);
+        }
+    }
+
+    // the leftmost-longest match starting at or after from and before limit,
+    // which may end beyond limit; as with the automata, settled is cleared when
+    // the threads alive at until may still change the outcome
+    bool find(const unsigned char *data, std::size_t size, std::size_t from, std::size_t limit,
+        std::size_t &match_begin, std::size_t &match_end, std::size_t until = npos, bool *settled = nullptr) const
+    {
+        if (begin)
+        {
+            match_begin = 0;
+            match_end = from || !limit ? npos : longest(data, size, 0);
+            return match_end != npos;
+        }
+
+        // a new thread starts at every position before limit until a match is found,
+        // while none is under way the prefilter skips to the next one it may start at;
+        // then only the threads started no later than the match go on
+        auto bound = limit < size ? std::min(size, limit + prefilter.width() - 1) : size;
+        auto last = std::min(size, until);
+        Scratch scratch(states.size(), repeats.size());
+        match_begin = npos;
+        for (auto pos = from; ; ++pos)
+        {
+            auto first = accepted(scratch, pos, size);
+            if (first != npos && first <= match_begin)
+            {
+                if (first < match_begin)
+                {
+                    match_begin = first;
+                    std::size_t count = 0;
+                    for (auto id: scratch.counting)
+                    {
+                        auto &counter = scratch.counters[states[id].repeat];
+                        counter.prune(first);
+                        if (!counter.empty())
+                        {
+                            scratch.counting[count++] = id;
+                        }
+                    }
+                    scratch.counting.resize(count);
+                }
+                match_end = pos;
+            }
+
+            if (match_begin == npos && pos < limit)
+            {
+                if (!scratch.alive() && prefilter.active())
+                {
+                    auto at = prefilter.next(data, bound, pos);
+                    if (at >= limit)
+                    {
+                        return false;
+                    }
+                    pos = at;
+                    ++scratch.stamp;
+                }
+                std::swap(scratch.now, scratch.next);
+                reach(scratch, start, pos, pos);
+                std::swap(scratch.now, scratch.next);
+            }
+            if (pos == last && pos < size && scratch.alive())
+            {
+                if (settled)
+                {
+                    *settled = false;
+                }
+                return false;
+            }
+            if (pos == last || (!scratch.alive() && (match_begin != npos || pos + 1 >= limit)))
+            {
+                return match_begin != npos;
+            }
+            step(scratch, pos, data[pos], match_begin);
+        }
+    }
+
+    // the bytes of the nfa and the prefilter, the scratch of a run is its own
+    std::size_t bytes() const
+    {
+        return states.size() * sizeof(NFAState) + sets.size() * sizeof(std::bitset<256>)
+            + repeats.size() * sizeof(Repeat) + prefilter.bytes();
+    }
+
+    std::string dot() const
+    {
+        return nfa_dot(states, sets, repeats, start, final);
+    }
+};
+
+class Node
+{
+  public:
+    virtual ~Node() {}
+    virtual NFAPair compile(NFA &nfa) = 0;
+
+    // whether the node matches one byte of a set, which is then set
+    virtual bool single(std::bitset<256> &) const
+    {
+        return false;
+    }
+
+    // the number of nodes of the tree, a shared subtree counted at every reference
+    virtual std::size_t count() const
+    {
+        return 1;
+    }
+};
+
+class LeafNode : public Node
+{
+  private:
+    unsigned char leaf;
+
+  public:
+    LeafNode(unsigned char c) : leaf(c) {}
+    virtual bool single(std::bitset<256> &set) const
+    {
+        set.reset().set(leaf);
+        return true;
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto pair = nfa.new_pair();
+        auto &start = nfa.states[pair.start];
+
+        start.edge_type = NFAState::EdgeType::CCL;
+        start.next = pair.end;
+        start.input_set = nfa.add_set(std::bitset<256>().set(leaf));
+
+        return pair;
+    }
+};
+
+class CatNode : public Node
+{
+  private:
+    std::shared_ptr<Node> left, right;
+
+  public:
+    CatNode(std::shared_ptr<Node> left, std::shared_ptr<Node> right) : left(left), right(right) {}
+    virtual std::size_t count() const
+    {
+        return 1 + left->count() + right->count();
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto left = this->left->compile(nfa);
+        auto right = this->right->compile(nfa);
+
+        nfa.states[left.end].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[left.end].next = right.start;
+
+        return NFAPair(left.start, right.end);
+    }
+};
+
+class SelectNode : public Node
+{
+  private:
+    std::vector<std::shared_ptr<Node>> branches;
+
+    // splits the branches [lo, hi) in halves, so a wide alternation of literals
+    // is entered through a tree of logarithmic depth
+    NFAPair compile(NFA &nfa, std::size_t lo, std::size_t hi)
+    {
+        if (hi - lo == 1)
+        {
+            return branches[lo]->compile(nfa);
+        }
+
+        auto left = compile(nfa, lo, lo + (hi - lo) / 2);
+        auto right = compile(nfa, lo + (hi - lo) / 2, hi);
+        auto pair = nfa.new_pair();
+
+        nfa.states[pair.start].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[pair.start].next = left.start;
+        nfa.states[pair.start].next2 = right.start;
+
+        nfa.states[left.end].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[right.end].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[left.end].next = pair.end;
+        nfa.states[right.end].next = pair.end;
+
+        return pair;
+    }
+
+  public:
+    SelectNode(std::vector<std::shared_ptr<Node>> branches) : branches(std::move(branches)) {}
+    virtual std::size_t count() const
+    {
+        std::size_t res = 1;
+        for (auto &branch: branches)
+        {
+            res += branch->count();
+        }
+        return res;
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        return compile(nfa, 0, branches.size());
+    }
+};
+
+class ClosureNode : public Node
+{
+  private:
+    std::shared_ptr<Node> content;
+
+  public:
+    ClosureNode(std::shared_ptr<Node> content) : content(content) {}
+    virtual std::size_t count() const
+    {
+        return 1 + content->count();
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto content = this->content->compile(nfa);
+        auto pair = nfa.new_pair();
+
+        nfa.states[pair.start].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[pair.start].next = content.start;
+        nfa.states[pair.start].next2 = pair.end;
+
+        nfa.states[content.end].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[content.end].next = content.start;
+        nfa.states[content.end].next2 = pair.end;
+
+        return pair;
+    }
+};
+
+class QualifierNode : public Node
+{
+  private:
+    std::shared_ptr<Node> content;
+    int n, m;
+
+    // count copies of content one after the other, count > 0; the first one tells how
+    // many states each takes and the others are only written out if they fit
+    NFAPair chain(NFA &nfa, int count)
+    {
+        auto before = nfa.states.size();
+        auto res = content->compile(nfa);
+        nfa.reserve(nfa.states.size() - before, count - 1);
+        for (int i = 1; i < count; ++i)
+        {
+            auto now = content->compile(nfa);
+            nfa.states[res.end].edge_type = NFAState::EdgeType::EPSILON;
+            nfa.states[res.end].next = now.start;
+            res.end = now.end;
+        }
+        return res;
+    }
+
+  public:
+    QualifierNode(std::shared_ptr<Node> content, int n, int m) : content(content), n(n), m(m) {}
+    virtual std::size_t count() const
+    {
+        return 1 + content->count();
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        // -2 means '{n}', -1 means '{n,}', >=0 means '{n,m}'
+        if (m == -2 && n > 0) // for '{n}'
+        {
+            return chain(nfa, n);
+        }
+        else if (m == -1) // for '{n,}'
+        {
+            if (!n)
+            {
+                return ClosureNode(content).compile(nfa);
+            }
+            auto pair = chain(nfa, n);
+            auto rest = ClosureNode(content).compile(nfa);
+            nfa.states[pair.end].edge_type = NFAState::EdgeType::EPSILON;
+            nfa.states[pair.end].next = rest.start;
+            return NFAPair(pair.start, rest.end);
+        }
+        else if (n < m && n >= 0) // for '{n,m}'
+        {
+            auto before = nfa.states.size();
+            auto first = content->compile(nfa);
+            nfa.reserve(nfa.states.size() - before, m - 1);
+            auto pair = nfa.new_pair();
+            auto pre = first;
+            nfa.states[pair.start].edge_type = NFAState::EdgeType::EPSILON;
+            nfa.states[pair.start].next = first.start;
+            if (n == 0)
+            {
+                nfa.states[pair.start].next2 = pair.end;
+            }
+
+            for (int i = 1; i < m; ++i)
+            {
+                auto now = content->compile(nfa);
+                nfa.states[pre.end].edge_type = NFAState::EdgeType::EPSILON;
+                nfa.states[pre.end].next = now.start;
+                if (i >= n)
+                {
+                    nfa.states[pre.end].next2 = pair.end;
+                }
+                pre = now;
+            }
+
+            nfa.states[pre.end].edge_type = NFAState::EdgeType::EPSILON;
+            nfa.states[pre.end].next = pair.end;
+            return pair;
+        }
+
+        auto pair = nfa.new_pair();
+        nfa.states[pair.start].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[pair.start].next = pair.end;
+        return pair;
+    }
+};
+
+// a repetition of one set of bytes as a single COUNT state, which counts
+// the rounds instead of going through a state per round
+class CountNode : public Node
+{
+  private:
+    std::bitset<256> set;
+    Repeat repeat;
+
+  public:
+    CountNode(const std::bitset<256> &set, Repeat repeat) : set(set), repeat(repeat) {}
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto pair = nfa.new_pair();
+        auto &start = nfa.states[pair.start];
+
+        start.edge_type = NFAState::EdgeType::COUNT;
+        start.next = pair.end;
+        start.input_set = nfa.add_set(set);
+        start.repeat = static_cast<std::uint32_t>(nfa.repeats.size());
+        nfa.repeats.push_back(repeat);
+
+        return pair;
+    }
+};
+
+// a group, whose start and end are recorded in the capture slots 2 * index and 2 * index + 1
+class GroupNode : public Node
+{
+  private:
+    std::shared_ptr<Node> content;
+    std::uint32_t index;
+
+  public:
+    GroupNode(std::shared_ptr<Node> content, std::uint32_t index) : content(content), index(index) {}
+    virtual std::size_t count() const
+    {
+        return 1 + content->count();
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto content = this->content->compile(nfa);
+        auto pair = nfa.new_pair();
+
+        nfa.states[pair.start].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[pair.start].next = content.start;
+        nfa.states[pair.start].save = 2 * index;
+
+        nfa.states[content.end].edge_type = NFAState::EdgeType::EPSILON;
+        nfa.states[content.end].next = pair.end;
+        nfa.states[pair.end].save = 2 * index + 1;
+
+        return pair;
+    }
+};
+
+class BracketNode : public Node
+{
+  private:
+    std::bitset<256> chrs;
+
+  public:
+    BracketNode(std::bitset<256> chrs) : chrs(chrs) {}
+    virtual bool single(std::bitset<256> &set) const
+    {
+        set = chrs;
+        return true;
+    }
+
+    virtual NFAPair compile(NFA &nfa)
+    {
+        auto pair = nfa.new_pair();
+        auto &start = nfa.states[pair.start];
+
+        start.edge_type = NFAState::EdgeType::CCL;
+        start.next = pair.end;
+        start.input_set = nfa.add_set(chrs);
+
+        return pair;
+    }
+};
+
+class Parser
+{
+  private:
+    bool begin, end;
+    // whether a repetition of one set of bytes becomes a COUNT state
+    bool counting;
+    std::map<std::string, std::shared_ptr<Node>> ref_map;
+    // the number of groups so far, group 0 is the whole match, and the named ones
+    std::uint32_t groups;
+    std::map<std::string, std::uint32_t> names;
+
+    unsigned char
+    translate_escape_chr(const unsigned char *&reading)
+    {
+        ++reading;
+        if (*reading)
+        {
+            switch (*reading)
+            {
+            case '0':
+                return '\0';
+            case 'a':
+                return '\a';
+            case 'b':
+                return '\b';
+            case 't':
+                return '\t';
+            case 'n':
+                return '\n';
+            case 'v':
+                return '\v';
+            case 'f':
+                return '\f';
+            case 'r':
+                return '\r';
+            case 'e':
+                return '\e';
+            case 'c':
+                if (*(reading+1) && (isalpha(*(reading+1)) || (*(reading + 1) > 63 && *(reading + 1) < 94)))
+                {
+                    ++reading;
+                    return toupper(*reading) - 64;
+                }
+                else
+                {
+                    return 'c';
+                }
+            default:
+                return *reading;
+            }
+        }
+        else return 255;
+    }
+
+    std::bitset<256>
+    translate_echr2bset(unsigned char &left,
+        const unsigned char *&reading,
+        bool range)
+    {
+        auto res = translate_escape_chr(reading);
+        std::bitset<256> ret;
+        if (details::ECMAP.count(res))
+        {
+            ret = details::ECMAP.at(res);
+        }
+        else if (range)
+        {
+            for (; left <= res; ++left)
+            {
+                ret.set(left);
+            }
+        }
+        else
+        {
+            left = res;
+        }
+        if (!range && details::ECMAP.count(res))
+        {
+            left = 255;
+        }
+        return ret;
+    }
+
+    std::shared_ptr<Node>
+    translate_echr2node(const unsigned char *&reading)
+    {
+        std::shared_ptr<Node> node = nullptr;
+        unsigned char left = 255;
+        auto res = translate_echr2bset(left, reading, false);
+        if (left == 255)
+        {
+            node = std::make_shared<BracketNode>(res);
+        }
+        else
+        {
+            node = std::make_shared<LeafNode>(left);
+        }
+        return node;
+    }
+
+    std::shared_ptr<Node>
+    gen_bracket(const unsigned char *&reading)
+    {
+        unsigned char left = 255;
+        bool range = false, exclude = false;
+        std::bitset<256> chrs;
+
+        if (*reading == '^')
+        {
+            ++reading;
+            exclude = true;
+        }
+        if (*reading == ']')
+        {
+            return std::make_shared<BracketNode>(chrs);
+        }
+
+        while (*reading && *reading != ']')
+        {
+            if (*reading == '-')
+            {
+                if (!range && left != 255)
+                {
+                    range = true;
+                }
+            }
+            else if (range)
+            {
+                if (*reading == '\\')
+                {
+                    chrs |= translate_echr2bset(left, reading, true);
+                }
+                else
+                {
+                    for(; left <= *reading; ++left) chrs.set(left);
+                }
+                left = 255;
+                range = false;
+            }
+            else
+            {
+                if (left != 255)
+                {
+                    chrs.set(left);
+                }
+                if (*reading == '\\')
+                {
+                    chrs |= translate_echr2bset(left, reading, false);
+                }
+                else left = *reading;
+            }
+            ++reading;
+        }
+
+        if (left != 255)
+        {
+            chrs.set(left);
+        }
+
+        if (exclude)
+        {
+            chrs.flip();
+        }
+
+        return std::make_shared<BracketNode>(chrs);
+    }
+
+    std::shared_ptr<Node>
+    gen_subexpr(const unsigned char *&reading)
+    {
+        std::shared_ptr<Node> node = nullptr;
+        if (*reading == '?')
+        {
+            ++reading;
+            if (*reading == ':')
+            {
+                ++reading;
+            }
+            if (*reading == '<')
+            {
+                ++reading;
+            }
+            std::string name;
+            while (isalnum(*reading) || *reading == '_')
+            {
+                name += *reading++;
+            }
+            if (*reading == '>')
+            {
+                ++reading;
+            }
+            if (*reading == ')')
+            {
+                if (ref_map.count(name))
+                {
+                    return ref_map[name];
+                }
+            }
+            else
+            {
+                // a named subexpression is a group, a reference
+                // to it matches it again without capturing
+                auto index = name.empty() ? 0 : groups++;
+                node = gen_node(reading);
+                ref_map[name] = node;
+                if (index && node)
+                {
+                    names[name] = index;
+                    node = std::make_shared<GroupNode>(node, index);
+                }
+            }
+        }
+        else
+        {
+            auto index = groups++;
+            node = gen_node(reading);
+            if (node)
+            {
+                node = std::make_shared<GroupNode>(node, index);
+            }
+        }
+        return node;
+    }
+
+    // the decimal count of a repetition, one that does not fit in an int is rejected
+    // rather than read as another, and so is one whose copies would take the nfa past
+    // NFA::MAX_STATES; the nfa engine counts any bound of one set of bytes in one
+    // state, the dfas of the others are held to Options::dfa_capacity
+    int
+    gen_count(const unsigned char *&reading)
+    {
+        int count = 0;
+        while (isdigit(*reading))
+        {
+            auto digit = *reading++ - '0';
+            if (count > (INT_MAX - digit) / 10)
+            {
+                throw std::out_of_range("cre: repetition count out of range");
+            }
+            count = count * 10 + digit;
+        }
+        return count;
+    }
+
+    // node repeated {n}, {n,} or {n,m} times as QualifierNode takes them,
+    // when counting a repetition of one set of bytes more than once counts
+    std::shared_ptr<Node>
+    gen_repeat(std::shared_ptr<Node> node, int n, int m)
+    {
+        if (m == n)
+        {
+            m = -2;
+        }
+        std::bitset<256> set;
+        auto max = m == -2 ? n : m == -1 ? Repeat::UNBOUNDED : static_cast<std::uint32_t>(m);
+        if (counting && n <= static_cast<std::int64_t>(max) && (max == Repeat::UNBOUNDED ? n > 1 : max > 1)
+            && node->single(set))
+        {
+            return std::make_shared<CountNode>(set, Repeat(n, max));
+        }
+        return std::make_shared<QualifierNode>(node, n, m);
+    }
+
+    // a single branch, up to the next '|', ')' or '$'
+    std::shared_ptr<Node>
+    gen_branch(const unsigned char *&reading)
+    {
+        std::shared_ptr<Node> node = nullptr, right = nullptr;
+
+        if (*reading == '^')
+        {
+            ++reading;
+            begin = true;
+        }
+
+        if (*reading == '(')
+        {
+            ++reading;
+            node = gen_subexpr(reading);
         }
         else if (*reading == '[')
         {
-            ++reading;
-            node = gen_bracket(reading);
+            ++reading;
+            node = gen_bracket(reading);
+        }
+        else if (*reading == '.')
+        {
+            std::bitset<256> accept(1024UL);
+            node = std::make_shared<BracketNode>(accept.flip());
+        }
+        else if (*reading && *reading != '|' && *reading != ')')
+        {
+            node = *reading == '\\'
+                ? translate_echr2node(reading)
+                : std::make_shared<LeafNode>(*reading);
+        }
+
+        if (!node)
+        {
+            return node;
+        }
+        ++reading;
+
+        while (*reading && *reading != '|' && *reading != ')' && *reading != '$')
+        {
+            switch (*reading)
+            {
+            case '(':
+                ++reading;
+                if (right)
+                {
+                    node = std::make_shared<CatNode>(node, right);
+                }
+                right = gen_subexpr(reading);
+                break;
+            case '[':
+                ++reading;
+                if (right)
+                {
+                    node = std::make_shared<CatNode>(node, right);
+                }
+                right = gen_bracket(reading);
+                break;
+            case '{':
+                ++reading;
+                if (isdigit(*reading))
+                {
+                    int n = gen_count(reading), m = -2;
+                    if (*reading == ',')
+                    {
+                        ++reading;
+                        m = isdigit(*reading)
+                            ? gen_count(reading)
+                            : -1;
+                    }
+
+                    if (right)
+                    {
+                        right = gen_repeat(right, n, m);
+                    }
+                    else
+                    {
+                        node = gen_repeat(node, n, m);
+                    }
+                }
+                break;
+            case '*':
+                if (right)
+                {
+                    right = std::make_shared<ClosureNode>(right);
+                }
+                else
+                {
+                    node = std::make_shared<ClosureNode>(node);
+                }
+                break;
+            case '+':
+                if (right)
+                {
+                    right = std::make_shared<QualifierNode>(right, 1, -1);
+                }
+                else
+                {
+                    node = std::make_shared<QualifierNode>(node, 1, -1);
+                }
+                break;
+            case '?':
+                if (right)
+                {
+                    right = std::make_shared<QualifierNode>(right, 0, 1);
+                }
+                else
+                {
+                    node = std::make_shared<QualifierNode>(node, 0, 1);
+                }
+                break;
+            case '.':
+                if (right)
+                {
+                    node = std::make_shared<CatNode>(node, right);
+                }
+                right = std::make_shared<BracketNode>(std::bitset<256>(1024ULL).flip());
+                break;
+            default:
+                if (right)
+                {
+                    node = std::make_shared<CatNode>(node, right);
+                }
+                right = *reading == '\\'
+                    ? translate_echr2node(reading)
+                    : std::make_shared<LeafNode>(*reading);
+                break;
+            }
+            ++reading;
+        }
+
+        if (right)
+        {
+            node = std::make_shared<CatNode>(node, right);
+        }
+        return node;
+    }
+
+    std::shared_ptr<Node>
+    gen_node(const unsigned char *&reading)
+    {
+        auto node = gen_branch(reading);
+        if (!node)
+        {
+            return node;
+        }
+
+        // the branches of an alternation are gathered flat, not nested one per '|'
+        if (*reading == '|')
+        {
+            std::vector<std::shared_ptr<Node>> branches = {node};
+            while (*reading == '|' && branches.back())
+            {
+                ++reading;
+                branches.push_back(gen_branch(reading));
+            }
+            node = std::make_shared<SelectNode>(std::move(branches));
+        }
+
+        if (*reading == '$')
+        {
+            ++reading;
+            end = true;
+        }
+        return node;
+    }
+
+  public:
+    Parser(bool counting = false) : begin(false), end(false), counting(counting), groups(1) {}
+
+    // the number of groups of the pattern parsed, the whole match included
+    std::uint32_t group_count() const
+    {
+        return groups;
+    }
+
+    const std::map<std::string, std::uint32_t> &group_names() const
+    {
+        return names;
+    }
+
+    // the nodes parsed and the time it took to parse them and to compile the nfa
+    // are added to stats
+    std::tuple<NFA, bool, bool>
+    gen_nfa(const unsigned char *reading, Stats *stats = nullptr)
+    {
+        NFA nfa;
+
+        auto parsing = std::chrono::steady_clock::now();
+        auto node = gen_node(reading);
+        auto compiling = std::chrono::steady_clock::now();
+        if (node)
+        {
+            auto pair = node->compile(nfa);
+            nfa.start = pair.start;
+            nfa.end = pair.end;
+        }
+        else
+        {
+            nfa.start = nfa.end = nfa.new_state();
+        }
+        if (stats)
+        {
+            stats->nodes += node ? node->count() : 0;
+            stats->parse_time += compiling - parsing;
+            stats->nfa_time += std::chrono::steady_clock::now() - compiling;
+        }
+
+        return std::make_tuple(std::move(nfa), begin, end);
+    }
+
+    std::tuple<DFA, bool, bool>
+    gen_dfa(const unsigned char *reading, const Options &options)
+    {
+        auto res = gen_nfa(reading);
+        return std::make_tuple(std::get<0>(res).to_dfa(options.minimize), std::get<1>(res), std::get<2>(res));
+    }
+};
+
+// calls work on every index below count from up to threads threads,
+// the indexes are handed out in increasing order
+template <typename Work>
+void parallel_for(std::size_t count, std::size_t threads, Work work)
+{
+    if (!threads)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::atomic<std::size_t> next(0);
+    auto run = [&]
+    {
+        for (std::size_t i; (i = next++) < count; )
+        {
+            work(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (std::size_t i = 1; i < std::min(threads, count); ++i)
+    {
+        pool.emplace_back(run);
+    }
+    run();
+    for (auto &thread: pool)
+    {
+        thread.join();
+    }
+}
+
+// every compiled pattern and pattern set gets its own id, caches filled for one
+// program are told apart from the others by it
+inline std::uint64_t new_program_id()
+{
+    static std::atomic<std::uint64_t> last(0);
+    return ++last;
+}
+
+// a compiled pattern, it is never changed once built and all copies of a Pattern share it
+class Program
+{
+  public:
+    // the first bytes of an image and the version of its layout, bumped on any change
+    static constexpr char MAGIC[4] = {'c', 'r', 'e', 'D'};
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::uint64_t id;
+    Engine engine;
+    Automata<DFA> dfa;
+    Automata<LazyDFA> lazy;
+    // the nfa engine runs the nfa with its repetitions counted, kept to build
+    // the lazy automata its streams run on once the first of them needs them
+    Simulation simulation;
+    NFA counting;
+    std::size_t cache_capacity;
+    // keeps alive the image a loaded program reads its tables from
+    std::shared_ptr<const void> owner;
+#ifdef CRE_JIT
+    // the machine code of dfa, when the engine is the jit
+    std::unique_ptr<const Jit> jit;
+#endif
+    // the number of groups, the whole match included, the pike vm that finds
+    // them in a match when there are more than it, and the numbers of the named ones
+    std::uint32_t groups;
+    Captures captures;
+    std::map<std::string, std::uint32_t> names;
+    Stats stats;
+
+    Program() : id(new_program_id()), engine(Engine::DFA), cache_capacity(0), groups(1) {}
+
+    Program(const std::string &pattern, const Options &options)
+      : id(new_program_id()), engine(options.engine), cache_capacity(options.cache_capacity), groups(1)
+    {
+        bool begin, end;
+        Parser parser(true);
+        std::tie(counting, begin, end) = parser.gen_nfa((unsigned char *)pattern.c_str(), &stats);
+        groups = parser.group_count();
+        if (groups > 1)
+        {
+            captures = Captures(counting, groups);
+            names = parser.group_names();
+        }
+
+        // a pattern whose repetitions are too large to write out, or whose automata do not
+        // fit in the capacity, falls back to the nfa engine; the nfa written out and the
+        // automata built so far count against the capacity, so the first that does not
+        // fit in what is left of it gives up on the rest
+        auto capacity = engine == Engine::DFA || engine == Engine::JIT ? options.dfa_capacity : 0;
+        NFA nfa;
+        if (engine != Engine::NFA)
+        {
+            auto unrolling = std::chrono::steady_clock::now();
+            auto unrolled = counting.unrolled(capacity ? std::min(NFA::MAX_STATES, capacity / sizeof(NFAState))
+                : NFA::MAX_STATES);
+            stats.nfa_time += std::chrono::steady_clock::now() - unrolling;
+            if (unrolled)
+            {
+                nfa = std::move(*unrolled);
+            }
+            else
+            {
+                engine = Engine::NFA;
+            }
+        }
+
+        if (engine == Engine::DFA || engine == Engine::JIT)
+        {
+            auto held = nfa.bytes();
+            bool fits = !capacity || held < capacity;
+            dfa = Automata<DFA>(nfa, begin, end, [&](NFA nfa, std::size_t limit)
+            {
+                // an automaton built under a limit is determinized while scanning
+                // when it does not fit, the rest of the automata may still do
+                auto res = fits ? nfa.to_dfa(options.minimize, capacity ? capacity - held : 0, &stats, limit)
+                    : std::nullopt;
+                held += res ? res->bytes() : 0;
+                fits = fits && (res || limit) && (!capacity || held < capacity);
+                return res;
+            }, options.cache_capacity);
+            if (!fits)
+            {
+                dfa = Automata<DFA>();
+                engine = Engine::NFA;
+            }
+        }
+        if (engine == Engine::LAZY_DFA)
+        {
+            lazy = Automata<LazyDFA>(nfa, begin, end, [&](const NFA &nfa, std::size_t)
+            {
+                return std::optional<LazyDFA>(LazyDFA(nfa, options.cache_capacity));
+            }, options.cache_capacity);
+        }
+        if (engine == Engine::NFA)
+        {
+            // the prefilter of the repetitions cut short finds every start of a match, and more
+            Prefilter prefilter;
+            auto widened = begin || end ? std::nullopt : counting.widened(Prefilter::MAX_LENGTH);
+            if (widened)
+            {
+                prefilter = Prefilter(widened->nonempty());
+            }
+            simulation = Simulation(counting, begin, end, prefilter);
+        }
+
+        if (engine == Engine::JIT)
+        {
+#ifdef CRE_JIT
+            jit = Jit::compile(dfa);
+            engine = jit ? Engine::JIT : Engine::DFA;
+#else
+            engine = Engine::DFA;
+#endif
+        }
+
+        if (engine == Engine::NFA)
+        {
+            stats.nfa_states = counting.states.size();
+            stats.byte_classes = ByteClasses(counting.sets).size();
+        }
+        else
+        {
+            counting = NFA();
+            stats.nfa_states = nfa.states.size();
+            stats.byte_classes = lazy_tables() ? lazy.forward.byte_classes().size() : dfa.forward.classes.size();
+        }
+        stats.bytes = bytes();
+    }
+
+    void save(Writer &out) const
+    {
+        out.bytes(MAGIC, sizeof(MAGIC));
+        out.u32(VERSION);
+        dfa.save(out);
+    }
+
+    bool load(Reader &in)
+    {
+        auto magic = in.bytes(sizeof(MAGIC));
+        if (!magic || std::memcmp(magic, MAGIC, sizeof(MAGIC)) || in.u32() != VERSION || !dfa.load(in) || !in.done())
+        {
+            return false;
+        }
+        // an automaton the pattern does not need is saved with no start state
+        for (auto automaton: {&dfa.forward, &dfa.unanchored, &dfa.reverse})
+        {
+            stats.dfa_states += automaton->start == DFA::DEAD ? 0 : automaton->accept.size();
+        }
+        stats.byte_classes = dfa.forward.classes.size();
+        stats.bytes = bytes();
+        return true;
+    }
+
+    // the bytes of the program and all it holds but the caches of the lazy dfa
+    // and the automata of the nfa engine's streams
+    std::size_t bytes() const
+    {
+        std::size_t res = sizeof(Program) + dfa.bytes() + lazy.bytes() + simulation.bytes() + counting.bytes()
+            + captures.bytes();
+        for (auto &name: names)
+        {
+            res += sizeof(name) + name.first.capacity() + 4 * sizeof(void *);
+        }
+#ifdef CRE_JIT
+        res += jit ? jit->bytes() : 0;
+#endif
+        return res;
+    }
+
+    // whether the tables are the lazy dfa's, which are filled in while scanning
+    bool lazy_tables() const
+    {
+        return engine == Engine::LAZY_DFA || engine == Engine::NFA;
+    }
+
+    // whether matches are pinned to the start or end of the input
+    bool anchored() const
+    {
+        return engine == Engine::NFA ? simulation.begin || simulation.end
+            : lazy_tables() ? lazy.begin || lazy.end : dfa.begin || dfa.end;
+    }
+
+    // the lazy automata streams run on, for the nfa engine those of the unrolled nfa,
+    // built by the first stream; a repetition too large to write out is rejected then
+    const Automata<LazyDFA> &streaming() const
+    {
+        if (engine != Engine::NFA)
+        {
+            return lazy;
         }
-        else if (*reading == '.')
+        std::call_once(streams_built, [&]
         {
-            std::bitset<256> accept(1024UL);
-            node = std::make_shared<BracketNode>(accept.flip());
+            auto nfa = counting.unrolled();
+            if (!nfa)
+            {
+                throw std::out_of_range("cre: repetition count out of range");
+            }
+            streams = Automata<LazyDFA>(*nfa, simulation.begin, simulation.end, [&](const NFA &nfa, std::size_t)
+            {
+                return std::optional<LazyDFA>(LazyDFA(nfa, cache_capacity));
+            }, cache_capacity);
+        });
+        return streams;
+    }
+
+  private:
+    mutable std::once_flag streams_built;
+    mutable Automata<LazyDFA> streams;
+};
+} // namespace details
+
+// a match as its offset and length in the caller's buffer
+class Span
+{
+  public:
+    static constexpr std::size_t npos = -1;
+
+    std::size_t offset, length;
+
+    Span() : offset(npos), length(0) {}
+    Span(std::size_t offset, std::size_t length) : offset(offset), length(length) {}
+
+    explicit operator bool() const
+    {
+        return offset != npos;
+    }
+
+    std::string_view of(std::string_view str) const
+    {
+        return *this ? str.substr(offset, length) : std::string_view();
+    }
+};
+
+// the states the lazy dfa engine has determinized so far for one pattern or pattern
+// set, a thread matching on its own cache shares the compiled pattern with the others
+// without any locking; the eager engine needs none but for an unanchored automaton
+// left to determinize while scanning
+class Cache
+{
+  private:
+    std::uint64_t program;
+    details::Automata<details::LazyDFA>::Caches lazy;
+
+  public:
+    // the number of programs a thread keeps a cache of when the caller gives none
+    static constexpr std::size_t MAX_LOCAL = 4;
+
+    Cache() : program(0) {}
+
+    // the caches for program id, emptied first if they were filled for another one
+    details::Automata<details::LazyDFA>::Caches &of(std::uint64_t id)
+    {
+        if (program != id)
+        {
+            program = id;
+            lazy = details::Automata<details::LazyDFA>::Caches();
         }
-        else if (*reading && *reading != '|' && *reading != ')')
+        return lazy;
+    }
+
+    // the calling thread's cache for program id, most recently used first
+    static Cache &local(std::uint64_t id)
+    {
+        thread_local std::list<Cache> caches;
+        auto it = std::find_if(caches.begin(), caches.end(), [&](const Cache &cache)
         {
-            node = *reading == '\\'
-                ? translate_echr2node(reading)
-                : std::make_shared<LeafNode>(*reading);
+            return cache.program == id;
+        });
+        if (it == caches.end())
+        {
+            // a new cache while there is room, else the least recently used one
+            it = caches.size() < MAX_LOCAL ? caches.emplace(caches.begin()) : std::prev(caches.end());
+        }
+        caches.splice(caches.begin(), caches, it);
+        caches.front().of(id);
+        return caches.front();
+    }
+};
+
+// a compiled pattern, its methods are const and one pattern may be used by any
+// number of threads at once; copies are cheap and share the compiled automata
+class Pattern
+{
+  private:
+    friend class Stream;
+
+    std::shared_ptr<const details::Program> program;
+
+    // the scans stop at until, settled is cleared when the outcome depends on what follows
+    bool find(std::string_view str, std::size_t from, std::size_t limit, std::size_t &match_begin,
+        std::size_t &match_end, Cache *cache, details::StartCache *starts = nullptr,
+        std::size_t until = Span::npos, bool *settled = nullptr) const
+    {
+        auto data = reinterpret_cast<const unsigned char *>(str.data());
+        if (program->engine == Engine::NFA)
+        {
+            return program->simulation.find(data, str.size(), from, limit, match_begin, match_end, until, settled);
+        }
+        if (program->engine == Engine::LAZY_DFA)
+        {
+            auto &scratch = (cache ? *cache : Cache::local(program->id)).of(program->id);
+            return program->lazy.find(data, str.size(), from, limit, match_begin, match_end, scratch, starts,
+                until, settled);
+        }
+#ifdef CRE_JIT
+        // the code scans whole inputs, the chunks of a parallel scan use the tables
+        if (program->jit && limit == str.size())
+        {
+            return program->jit->find(program->dfa, data, str.size(), from, match_begin, match_end);
+        }
+#endif
+        details::Automata<details::DFA>::Caches scratch;
+        if (!program->dfa.tables())
+        {
+            auto &lazy = (cache ? *cache : Cache::local(program->id)).of(program->id);
+            scratch.lazy_unanchored = &lazy.unanchored;
+            scratch.lazy_reverse = &lazy.reverse;
+        }
+        return program->dfa.find(data, str.size(), from, limit, match_begin, match_end, scratch, starts,
+            until, settled);
+    }
+
+    Span match_span(std::string_view str, Cache *cache) const
+    {
+        auto data = reinterpret_cast<const unsigned char *>(str.data());
+        std::size_t len;
+        if (program->engine == Engine::NFA)
+        {
+            len = program->simulation.longest(data, str.size(), 0);
+        }
+        else if (program->engine == Engine::LAZY_DFA)
+        {
+            auto &scratch = (cache ? *cache : Cache::local(program->id)).of(program->id);
+            len = program->lazy.longest(data, str.size(), 0, scratch);
+        }
+#ifdef CRE_JIT
+        else if (program->jit)
+        {
+            len = program->jit->longest(data, str.size(), 0);
+        }
+#endif
+        else
+        {
+            details::Automata<details::DFA>::Caches scratch;
+            len = program->dfa.longest(data, str.size(), 0, scratch);
+        }
+        return len == Span::npos ? Span() : Span(0, len);
+    }
+
+    Span search_span(std::string_view str, std::size_t pos, Cache *cache) const
+    {
+        std::size_t match_begin, match_end;
+        return pos <= str.size() && find(str, pos, str.size(), match_begin, match_end, cache)
+            ? Span(match_begin, match_end - match_begin)
+            : Span();
+    }
+
+    std::vector<Span> matches_span(std::string_view str, Cache *cache) const
+    {
+        std::vector<Span> res;
+        details::StartCache starts;
+        std::size_t from = 0, match_begin, match_end;
+        while (from < str.size() && find(str, from, str.size(), match_begin, match_end, cache, &starts))
+        {
+            res.emplace_back(match_begin, match_end - match_begin);
+            from = match_end;
+        }
+
+        return res;
+    }
+
+    // the matches of a chunk, found as if one ended at its begin, and where its
+    // scan stopped if a match or thread was still under way at its end
+    class Chunk
+    {
+      public:
+        std::vector<Span> spans;
+        std::size_t open = Span::npos;
+    };
+
+    // the matches that start and end in [chunk begin, chunk end), those of all chunks
+    // at once; no scan goes past its chunk, the serial stitch runs any that must
+    std::vector<Chunk> chunk_matches(std::string_view str, const Parallel &parallel) const
+    {
+        auto chunk = std::max<std::size_t>(parallel.chunk_size, 1);
+        std::vector<Chunk> res((str.size() + chunk - 1) / chunk);
+        details::parallel_for(res.size(), parallel.threads, [&](std::size_t i)
+        {
+            auto lo = i * chunk, hi = std::min(str.size(), lo + chunk);
+            details::StartCache starts;
+            std::size_t from = lo, match_begin, match_end;
+            while (from < hi)
+            {
+                bool settled = true;
+                if (!find(str, from, hi, match_begin, match_end, nullptr, &starts, hi, &settled))
+                {
+                    if (!settled)
+                    {
+                        res[i].open = from;
+                    }
+                    break;
+                }
+                res[i].spans.emplace_back(match_begin, match_end - match_begin);
+                from = match_end;
+            }
+        });
+
+        return res;
+    }
+
+    Pattern(std::shared_ptr<const details::Program> program) : program(std::move(program)) {}
+
+  public:
+    Pattern(const std::string &pattern, const Options &options = Options())
+      : program(std::make_shared<const details::Program>(pattern, options)) {}
+
+    // the engine the pattern runs on: the one of its options, but the nfa engine for
+    // a pattern whose dfa outgrew Options::dfa_capacity or whose repetitions are too
+    // large to write out, and the dfa engine where the jit is not supported or the dfa
+    // too large for it
+    Engine engine() const
+    {
+        return program->engine;
+    }
+
+    // what compiling the pattern took; a loaded pattern has only the counts of its tables
+    const Stats &stats() const
+    {
+        return program->stats;
+    }
+
+    // the automaton the pattern matches with as a graph in the dot language of graphviz:
+    // the forward dfa, the nfa of the nfa engine or the one a lazy dfa determinizes
+    std::string dot() const
+    {
+        switch (program->engine)
+        {
+        case Engine::NFA:
+            return program->simulation.dot();
+        case Engine::LAZY_DFA:
+            return program->lazy.forward.dot();
+        default:
+            return program->dfa.forward.dot();
+        }
+    }
+
+    // the compiled automata as a binary image for load, empty for the lazy dfa
+    // and nfa engines, which have no tables to save; so a pattern whose dfa outgrew
+    // Options::dfa_capacity and fell back to the nfa engine cannot be saved either,
+    // nor one whose unanchored or reverse automaton is determinized while scanning
+    std::string save() const
+    {
+        details::Writer out;
+        if (!program->lazy_tables() && program->dfa.tables())
+        {
+            program->save(out);
+        }
+        return std::move(out.out);
+    }
+
+    // the pattern saved in image, nothing if it is not a valid image of this version;
+    // the tables are copied out of image, unless an owner of it is given: then they
+    // are read where they are when the image is aligned to four bytes, as a mapped
+    // file is, and owner is kept alive with the pattern
+    static std::optional<Pattern> load(std::string_view image, std::shared_ptr<const void> owner = nullptr)
+    {
+        auto program = std::make_shared<details::Program>();
+        details::Reader in(image.data(), image.size(), owner != nullptr);
+        if (!program->load(in))
+        {
+            return std::nullopt;
+        }
+        program->owner = std::move(owner);
+        return Pattern(std::move(program));
+    }
+
+    // the number of groups, group 0 is the whole match and the parenthesized
+    // subexpressions, named or not, are numbered from 1 in the order they open;
+    // a reference to a named one, (?<name>), is no group
+    std::size_t groups() const
+    {
+        return program->groups;
+    }
+
+    // the number of the group called name, 0 if there is none
+    std::size_t group(const std::string &name) const
+    {
+        auto it = program->names.find(name);
+        return it == program->names.end() ? 0 : it->second;
+    }
+
+    // the groups of match, one the *_span methods found in str: res[0] is match and
+    // res[i] the last span group i matched, empty if it took no part, or nothing
+    // without a match; the groups are not saved, a loaded pattern has group 0 only
+    std::vector<Span> groups(std::string_view str, Span match) const
+    {
+        if (!match)
+        {
+            return {};
+        }
+        std::vector<Span> res(program->groups);
+        res[0] = match;
+        if (program->groups > 1)
+        {
+            auto slots = program->captures.run(reinterpret_cast<const unsigned char *>(str.data()),
+                match.offset, match.offset + match.length);
+            for (std::size_t i = 1; i < res.size() && !slots.empty(); ++i)
+            {
+                if (slots[2 * i] != Span::npos && slots[2 * i + 1] != Span::npos)
+                {
+                    res[i] = Span(slots[2 * i], slots[2 * i + 1] - slots[2 * i]);
+                }
+            }
+        }
+        return res;
+    }
+
+    // the groups of the longest match at the start of str
+    std::vector<Span> match_groups(std::string_view str) const
+    {
+        return groups(str, match_span(str));
+    }
+
+    // the groups of the leftmost-longest match starting at or after pos
+    std::vector<Span> search_groups(std::string_view str, std::size_t pos = 0) const
+    {
+        return groups(str, search_span(str, pos));
+    }
+
+    // the longest match at the start of str
+    Span match_span(std::string_view str) const
+    {
+        return match_span(str, nullptr);
+    }
+
+    Span match_span(std::string_view str, Cache &cache) const
+    {
+        return match_span(str, &cache);
+    }
+
+    // the leftmost-longest match starting at or after pos
+    Span search_span(std::string_view str, std::size_t pos = 0) const
+    {
+        return search_span(str, pos, nullptr);
+    }
+
+    Span search_span(std::string_view str, std::size_t pos, Cache &cache) const
+    {
+        return search_span(str, pos, &cache);
+    }
+
+    // the consecutive leftmost-longest matches that do not overlap
+    std::vector<Span> matches_span(std::string_view str) const
+    {
+        return matches_span(str, nullptr);
+    }
+
+    std::vector<Span> matches_span(std::string_view str, Cache &cache) const
+    {
+        return matches_span(str, &cache);
+    }
+
+    // search_span with the input split into chunks searched by parallel threads,
+    // the match found is the one a serial search finds
+    Span search_span(std::string_view str, std::size_t pos, const Parallel &parallel) const
+    {
+        auto chunk = std::max<std::size_t>(parallel.chunk_size, 1);
+        if (pos > str.size() || str.size() - pos <= chunk || program->anchored())
+        {
+            return search_span(str, pos);
+        }
+
+        // the first chunk a match starts in holds the leftmost one, no chunk after one
+        // known to hold a match is searched; a chunk whose scan reached its end with
+        // a thread alive may hold it too, it is searched again serially from its begin
+        std::vector<Span> found((str.size() - pos + chunk - 1) / chunk);
+        std::vector<char> open(found.size());
+        std::atomic<std::size_t> first(found.size());
+        details::parallel_for(found.size(), parallel.threads, [&](std::size_t i)
+        {
+            if (i > first)
+            {
+                return;
+            }
+            auto lo = pos + i * chunk, hi = std::min(str.size(), lo + chunk);
+            std::size_t match_begin, match_end;
+            bool settled = true;
+            auto hit = find(str, lo, hi, match_begin, match_end, nullptr, nullptr, hi, &settled);
+            if (hit || !settled)
+            {
+                if (hit)
+                {
+                    found[i] = Span(match_begin, match_end - match_begin);
+                }
+                open[i] = !settled;
+                for (auto j = first.load(); i < j && !first.compare_exchange_weak(j, i); );
+            }
+        });
+
+        if (first < found.size() && open[first])
+        {
+            return search_span(str, pos + first * chunk);
+        }
+        return first < found.size() ? found[first] : Span();
+    }
+
+    // matches_span with the input split into chunks scanned by parallel threads,
+    // the matches found are the ones a serial scan finds
+    std::vector<Span> matches_span(std::string_view str, const Parallel &parallel) const
+    {
+        if (str.size() <= std::max<std::size_t>(parallel.chunk_size, 1) || program->anchored())
+        {
+            return matches_span(str);
+        }
+
+        // every chunk was scanned as if the previous one ended at its begin, the
+        // serial scan reaches a chunk at from instead and agrees with the chunk's
+        // matches from the first one that starts after from, unless from is inside
+        // the match before it, then it is stepped forward until it is not; where the
+        // chunk's scan stopped open the serial one goes on past its end by itself,
+        // the way the serial scan of the whole input would
+        auto chunks = chunk_matches(str, parallel);
+        auto chunk = std::max<std::size_t>(parallel.chunk_size, 1);
+        std::vector<Span> res;
+        details::StartCache starts;
+        std::size_t from = 0, match_begin, match_end;
+        while (from < str.size())
+        {
+            auto i = from / chunk;
+            auto &spans = chunks[i].spans;
+            auto lo = i * chunk, hi = std::min(str.size(), lo + chunk);
+            auto it = std::lower_bound(spans.begin(), spans.end(), from, [](const Span &span, std::size_t at)
+            {
+                return span.offset < at;
+            });
+            auto last = it == spans.begin() ? lo : std::prev(it)->offset + std::prev(it)->length;
+            if (last <= from)
+            {
+                res.insert(res.end(), it, spans.end());
+                if (it != spans.end())
+                {
+                    from = spans.back().offset + spans.back().length;
+                }
+                if (chunks[i].open == Span::npos)
+                {
+                    from = hi;
+                    continue;
+                }
+            }
+            else
+            {
+                bool settled = true;
+                auto hit = find(str, from, hi, match_begin, match_end, nullptr, &starts, hi, &settled);
+                if (settled)
+                {
+                    if (hit)
+                    {
+                        res.emplace_back(match_begin, match_end - match_begin);
+                    }
+                    from = hit ? match_end : hi;
+                    continue;
+                }
+            }
+
+            if (!find(str, from, str.size(), match_begin, match_end, nullptr, &starts))
+            {
+                break;
+            }
+            res.emplace_back(match_begin, match_end - match_begin);
+            from = match_end;
+        }
+
+        return res;
+    }
+
+    std::string match(std::string_view str) const
+    {
+        return std::string(match_span(str).of(str));
+    }
+
+    std::string match(const char *data, std::size_t size) const
+    {
+        return match(std::string_view(data, size));
+    }
+
+    std::string search(std::string_view str) const
+    {
+        return std::string(search_span(str).of(str));
+    }
+
+    std::string search(const char *data, std::size_t size) const
+    {
+        return search(std::string_view(data, size));
+    }
+
+    std::string replace(std::string_view str, std::string_view target) const
+    {
+        std::string res;
+        std::size_t from = 0;
+        for (auto &span: matches_span(str))
+        {
+            res.append(str.substr(from, span.offset - from));
+            res.append(target);
+            from = span.offset + span.length;
+        }
+        res.append(str.substr(from));
+
+        return res;
+    }
+
+    std::string replace(const char *data, std::size_t size, std::string_view target) const
+    {
+        return replace(std::string_view(data, size), target);
+    }
+
+    std::vector<std::string> matches(std::string_view str) const
+    {
+        std::vector<std::string> res;
+        for (auto &span: matches_span(str))
+        {
+            res.emplace_back(span.of(str));
         }
 
-        if (!node)
-        {
-            return node;
-        }
-        ++reading;
+        return res;
+    }
+
+    std::vector<std::string> matches(const char *data, std::size_t size) const
+    {
+        return matches(std::string_view(data, size));
+    }
+};
+
+// the pattern saved in Image, an array of static storage such as the ones cre-embed
+// writes at build time; it is loaded on first use, with no compile, and its tables
+// are read where the array is; throws std::bad_optional_access on an invalid image
+template <const auto &Image>
+const Pattern &embedded()
+{
+    // the array lives as long as the program, its owner is one that frees nothing
+    static const Pattern pattern = Pattern::load(std::string_view(reinterpret_cast<const char *>(Image), sizeof(Image)),
+        std::shared_ptr<const void>(std::shared_ptr<const void>(), Image)).value();
+    return pattern;
+}
+
+// matches a pattern against an input that arrives in pieces and reports the matches
+// Pattern::matches_span finds in the whole input, at their offsets in it; no input is
+// kept and none is scanned twice, only the automaton states of the matches that may
+// still be under way are carried from one piece to the next
+class Stream
+{
+  public:
+    using Callback = std::function<void(Span)>;
+
+  private:
+    // a match under way from begin, end is the end of its longest match so far
+    class Candidate
+    {
+      public:
+        std::size_t begin, end;
+        std::uint32_t state;
+
+        Candidate(std::size_t begin, std::uint32_t state) : begin(begin), end(Span::npos), state(state) {}
+    };
+
+    std::shared_ptr<const details::Program> program;
+    // the lazy automata of the program the stream runs on, if it runs on any
+    const details::Automata<details::LazyDFA> *lazy;
+    Callback callback;
+    Cache cache;
+    std::size_t fed;
+    std::vector<Candidate> candidates;
+    // per state the last candidate settle kept in it, npos for none
+    std::vector<std::size_t> kept;
 
-        while (*reading && *reading != '|' && *reading != ')' && *reading != '$')
+    template <typename Automaton, typename Forward>
+    void scan(const details::Automata<Automaton> &automata, Forward &&forward,
+        const unsigned char *data, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; ++i, ++fed)
         {
-            switch (*reading)
+            if (candidates.empty())
             {
-            case '(':
-                ++reading;
-                if (right)
-                {
-                    node = std::make_shared<CatNode>(node, right);
-                }
-                right = gen_subexpr(reading);
-                break;
-            case '[':
-                ++reading;
-                if (right)
+                if (automata.begin && fed)
                 {
-                    node = std::make_shared<CatNode>(node, right);
+                    fed += size - i;
+                    return;
                 }
-                right = gen_bracket(reading);
-                break;
-            case '{':
-                ++reading;
-                if (isdigit(*reading))
+                // no match is under way, skip to where one may start, but not over
+                // a literal cut off by the end of this piece
+                if (automata.prefilter.active())
                 {
-                    int n = *reading - '0', m = -2;
-                    ++reading;
-                    if (*reading == ',')
-                    {
-                        ++reading;
-                        m = isdigit(*reading)
-                            ? *reading++ - '0'
-                            : -1;
-                    }
-
-                    if (right)
-                    {
-                        right = std::make_shared<QualifierNode>(right, n, m);
-                    }
-                    else
+                    auto cut = size - std::min(size, automata.prefilter.width() - 1);
+                    auto at = std::min(automata.prefilter.next(data, size, i), std::max(i, cut));
+                    fed += at - i;
+                    i = at;
+                    if (i == size)
                     {
-                        node = std::make_shared<QualifierNode>(node, n, m);
+                        return;
                     }
                 }
-                break;
-            case '*':
-                if (right)
-                {
-                    right = std::make_shared<ClosureNode>(right);
-                }
-                else
-                {
-                    node = std::make_shared<ClosureNode>(node);
-                }
-                break;
-            case '+':
-                if (right)
-                {
-                    right = std::make_shared<QualifierNode>(right, 1, -1);
-                }
-                else
+            }
+
+            if (!automata.begin || !fed)
+            {
+                candidates.emplace_back(fed, forward.start);
+            }
+            for (std::size_t k = 0; k < candidates.size(); ++k)
+            {
+                auto &candidate = candidates[k];
+                if (candidate.state == Automaton::DEAD)
                 {
-                    node = std::make_shared<QualifierNode>(node, 1, -1);
+                    continue;
                 }
-                break;
-            case '?':
-                if (right)
+
+                auto flushes = forward.flushes();
+                candidate.state = forward.next(candidate.state, data[i]);
+                if (forward.flushes() != flushes)
                 {
-                    right = std::make_shared<QualifierNode>(right, 0, 1);
+                    for (std::size_t j = 0; j < candidates.size(); ++j)
+                    {
+                        if (j != k && candidates[j].state != Automaton::DEAD)
+                        {
+                            candidates[j].state = forward.revive(candidates[j].state);
+                        }
+                    }
                 }
-                else
+                if (!automata.end && forward.accept[candidate.state])
                 {
-                    node = std::make_shared<QualifierNode>(node, 0, 1);
+                    candidate.end = fed + 1;
                 }
-                break;
-            case '.':
-                if (right)
+            }
+            settle<Automaton>(automata.end, forward.accept.size());
+        }
+    }
+
+    // drops the candidates that can no longer make a difference and reports the
+    // leftmost match once no match starting before it is under way
+    template <typename Automaton>
+    void settle(bool end, std::size_t states)
+    {
+        if (kept.size() < states)
+        {
+            kept.resize(states, Span::npos);
+        }
+
+        std::size_t count = 0;
+        for (auto &candidate: candidates)
+        {
+            if (candidate.state == Automaton::DEAD && (end || candidate.end == Span::npos))
+            {
+                continue;
+            }
+
+            // a candidate in the state of one kept before it has the same future,
+            // it is dropped if that one's match would cut it anyway; with $ no match
+            // is cut short before the end of the input, without it the earlier one
+            // may be, by a match ending between the two, which the later one survives
+            auto last = kept[candidate.state];
+            if (last != Span::npos && candidate.state != Automaton::DEAD)
+            {
+                auto &other = candidates[last];
+                auto between = [&](const Candidate &cutting)
                 {
-                    node = std::make_shared<CatNode>(node, right);
-                }
-                right = std::make_shared<BracketNode>(std::bitset<256>(1024ULL).flip());
-                break;
-            default:
-                if (right)
+                    return cutting.end != Span::npos && cutting.end > other.begin && cutting.end <= candidate.begin;
+                };
+                if (end || ((candidate.end == Span::npos || (other.end != Span::npos && other.end > candidate.begin))
+                    && std::none_of(candidates.begin(), candidates.begin() + last, between)))
                 {
-                    node = std::make_shared<CatNode>(node, right);
+                    continue;
                 }
-                right = *reading == '\\'
-                    ? translate_echr2node(reading)
-                    : std::make_shared<LeafNode>(*reading);
-                break;
             }
-            ++reading;
+            kept[candidate.state] = count;
+            candidates[count++] = candidate;
+        }
+        candidates.resize(count, Candidate(0, 0));
+        for (auto &candidate: candidates)
+        {
+            kept[candidate.state] = Span::npos;
         }
 
-        if (*reading == '|')
+        while (!end && candidates.size() && candidates[0].state == Automaton::DEAD)
         {
-            ++reading;
-            if (right)
+            cut(candidates[0].begin, candidates[0].end);
+        }
+    }
+
+    // reports a match and drops the candidates it overlaps
+    void cut(std::size_t begin, std::size_t end)
+    {
+        callback(Span(begin, end - begin));
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate &candidate)
+        {
+            return candidate.begin >= end;
+        });
+        candidates.erase(candidates.begin(), it);
+    }
+
+    template <typename Automaton, typename Forward>
+    void finish(const details::Automata<Automaton> &automata, Forward &&forward)
+    {
+        while (candidates.size())
+        {
+            auto &candidate = candidates[0];
+            if (automata.end ? forward.accept[candidate.state] : candidate.end != Span::npos)
+            {
+                cut(candidate.begin, automata.end ? fed : candidate.end);
+            }
+            else
             {
-                node = std::make_shared<CatNode>(node, right);
+                candidates.erase(candidates.begin());
             }
-            node = std::make_shared<SelectNode>(node, gen_node(reading));
         }
-        else if (right)
+    }
+
+  public:
+    // the streams of a pattern on the nfa engine run on lazy automata of it with its
+    // repetitions written out, so one too large for that throws out_of_range
+    Stream(const Pattern &pattern, Callback callback)
+      : program(pattern.program), lazy(program->lazy_tables() ? &program->streaming() : nullptr),
+        callback(std::move(callback)), fed(0) {}
+
+    // scans the next piece of the input, reporting the matches it settles
+    void feed(std::string_view str)
+    {
+        auto data = reinterpret_cast<const unsigned char *>(str.data());
+        if (lazy)
         {
-            node = std::make_shared<CatNode>(node, right);
+            auto &scratch = cache.of(program->id);
+            scan(*lazy, lazy->forward.bind(scratch.forward), data, str.size());
         }
-
-        if (*reading == '$')
+        else
         {
-            ++reading;
-            end = true;
+            details::DFA::Cache scratch;
+            scan(program->dfa, program->dfa.forward.bind(scratch), data, str.size());
         }
-        return node;
     }
 
-  public:
-    Parser() = default;
+    void feed(const char *data, std::size_t size)
+    {
+        feed(std::string_view(data, size));
+    }
 
-    std::tuple<std::shared_ptr<DFAState>, bool, bool>
-    gen_dfa(const unsigned char *reading)
+    // ends the input, reporting the matches still under way, the stream then
+    // starts over with a new input
+    void finish()
     {
-        std::shared_ptr<DFAState> dfa;
+        if (lazy)
+        {
+            auto &scratch = cache.of(program->id);
+            finish(*lazy, lazy->forward.bind(scratch.forward));
+        }
+        else
+        {
+            details::DFA::Cache scratch;
+            finish(program->dfa, program->dfa.forward.bind(scratch));
+        }
+        fed = 0;
+    }
 
-        auto node = gen_node(reading);
-        dfa = node
-            ? node->compile()->to_dfa()
-            : std::make_shared<DFAState>(DFAState::State::END);
+    // the number of bytes fed since the input began
+    std::size_t size() const
+    {
+        return fed;
+    }
 
-        return std::make_tuple(dfa, begin, end);
+    // the number of matches under way: at most a few without an end yet per state
+    // of the automaton, however long the input, and the ones found that wait for
+    // an earlier match still under way, which may cut them short
+    std::size_t pending() const
+    {
+        return candidates.size();
     }
 };
-} // namespace details
 
-class Pattern
+// the contents of a file to scan in place: a regular file is mapped into memory
+// where the platform allows, anything else, like a pipe, is read into a buffer;
+// "-" is the standard input
+class File
 {
   private:
-    std::shared_ptr<details::DFAState> dfa;
-    bool begin, end;
+    const char *base;
+    std::size_t length;
+    bool mapped, opened;
+    std::string buffer;
+
+    bool read(std::FILE *file)
+    {
+        char chunk[1 << 16];
+        std::size_t count;
+        while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+        {
+            buffer.append(chunk, count);
+        }
+        base = buffer.data();
+        length = buffer.size();
+        return !std::ferror(file);
+    }
 
   public:
-    Pattern(const std::string pattern)
+    File(const std::string &path) : base(nullptr), length(0), mapped(false), opened(false)
+    {
+        if (path == "-")
+        {
+            opened = read(stdin);
+            return;
+        }
+
+#ifdef CRE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (!::fstat(fd, &info) && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            auto addr = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                ::madvise(addr, info.st_size, MADV_SEQUENTIAL);
+                base = static_cast<const char *>(addr);
+                length = info.st_size;
+                mapped = opened = true;
+                ::close(fd);
+                return;
+            }
+        }
+        ::close(fd);
+#endif
+
+        auto file = std::fopen(path.c_str(), "rb");
+        if (file)
+        {
+            opened = read(file);
+            std::fclose(file);
+        }
+    }
+
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+
+    ~File()
+    {
+#ifdef CRE_MMAP
+        if (mapped)
+        {
+            ::munmap(const_cast<char *>(base), length);
+        }
+#endif
+    }
+
+    // false when the file could not be opened or read
+    explicit operator bool() const
     {
-        std::tie(dfa, begin, end) = details::Parser().gen_dfa((unsigned char *)pattern.c_str());
+        return opened;
     }
 
-    std::string match(const std::string &str)
+    std::string_view view() const
     {
-        std::string res, temp;
+        return std::string_view(base, length);
+    }
+};
+
+// many patterns compiled into one automaton, a single pass over the input tells
+// which of them have a match in it; like Pattern it is not changed by matching
+class PatternSet
+{
+  private:
+    std::uint64_t id;
+    // the lazy dfa or the dfa engine, as engine tells
+    Engine chosen;
+    details::DFA dfa;
+    details::LazyDFA lazy;
+    // the patterns whose match has to end at the end of the input
+    std::vector<bool> end;
 
-        auto reading = str.c_str();
-        auto state = dfa;
+    template <typename Automaton>
+    std::vector<bool> scan(Automaton &automaton, const unsigned char *data, std::size_t size) const
+    {
+        std::vector<bool> res(end.size(), false), noted(automaton.tag_sets.size(), false);
+        auto left = end.size();
 
-        while (*reading)
+        // the patterns accepted in state, those ending at $ only at the end of the input
+        auto note = [&](std::uint32_t state, bool at_end)
         {
-            if (state->to.count(*reading))
+            auto tag = automaton.tag[state];
+            if (noted[tag] && !at_end)
             {
-                state = state->to[*reading];
+                return;
             }
-            else if (end)
+            noted[tag] = true;
+            for (auto id: automaton.tag_sets[tag])
             {
-                return "";
+                if (!res[id] && (at_end || !end[id]))
+                {
+                    res[id] = true;
+                    --left;
+                }
             }
-            else
+        };
+
+        auto state = automaton.start;
+        for (std::size_t i = 0; i < size && left; ++i)
+        {
+            state = automaton.next(state, data[i]);
+            if (state == Automaton::DEAD)
             {
-                break;
+                return res;
             }
-
-            temp += *reading;
-
-            if (state->state_type == details::DFAState::State::END)
+            if (automaton.accept[state])
             {
-                res += temp;
-                temp = "";
+                if (automaton.tag[state] >= noted.size())
+                {
+                    noted.resize(automaton.tag_sets.size(), false);
+                }
+                note(state, false);
             }
-            ++reading;
+        }
+        if (automaton.accept[state])
+        {
+            note(state, true);
         }
         return res;
     }
 
-    std::string search(const std::string &str)
+  public:
+    PatternSet(const std::vector<std::string> &patterns, const Options &options = Options())
+      : id(details::new_program_id()), chosen(options.engine == Engine::LAZY_DFA ? Engine::LAZY_DFA : Engine::DFA)
     {
-        if (begin)
+        std::vector<details::NFA> nfas;
+        std::vector<bool> begin;
+        for (auto &pattern: patterns)
         {
-            return match(str);
+            details::NFA nfa;
+            bool b, e;
+            std::tie(nfa, b, e) = details::Parser().gen_nfa((unsigned char *)pattern.c_str());
+            nfas.push_back(nfa.nonempty());
+            begin.push_back(b);
+            end.push_back(e);
         }
 
-        std::string res;
-        for (std::size_t i = 0; i < str.size(); ++i)
+        // a set has no simulation of its own, one whose dfa does not fit in the capacity
+        // runs on the lazy dfa, which determinizes only what the input reaches
+        auto nfa = details::NFA::tagged_union(nfas, begin);
+        if (chosen == Engine::DFA)
         {
-            res = match(str.substr(i));
-            if (!res.empty())
+            auto res = nfa.to_dfa(options.minimize, options.dfa_capacity);
+            if (res)
             {
-                return res;
+                dfa = std::move(*res);
             }
+            else
+            {
+                chosen = Engine::LAZY_DFA;
+            }
+        }
+        if (chosen == Engine::LAZY_DFA)
+        {
+            lazy = details::LazyDFA(nfa, options.cache_capacity);
         }
+    }
 
-        return res;
+    std::size_t size() const
+    {
+        return end.size();
     }
 
-    std::string replace(const std::string &str, const std::string &target)
+    // the engine the set runs on, the dfa or the lazy dfa engine; the other
+    // engines of the options run on the dfa, or the lazy dfa when it outgrew
+    // Options::dfa_capacity
+    Engine engine() const
     {
-        if (begin)
+        return chosen;
+    }
+
+    // res[i] tells whether the i-th pattern has a match in str
+    std::vector<bool> matches(std::string_view str, Cache &cache) const
+    {
+        auto data = reinterpret_cast<const unsigned char *>(str.data());
+        if (chosen == Engine::LAZY_DFA)
         {
-            return target + str.substr(match(str).size());
+            auto automaton = lazy.bind(cache.of(id).forward);
+            return scan(automaton, data, str.size());
         }
+        return scan(dfa, data, str.size());
+    }
 
-        std::string res;
-        for (std::size_t i = 0; i < str.size(); ++i)
+    std::vector<bool> matches(std::string_view str) const
+    {
+        if (chosen == Engine::LAZY_DFA)
         {
-            auto tmp = match(str.substr(i));
-            if (tmp.empty())
-            {
-                res += str[i];
-            }
-            else
-            {
-                res += target;
-                i += tmp.size() - 1;
-            }
+            return matches(str, Cache::local(id));
         }
+        return scan(dfa, reinterpret_cast<const unsigned char *>(str.data()), str.size());
+    }
 
-        return res;
+    std::vector<bool> matches(const char *data, std::size_t size) const
+    {
+        return matches(std::string_view(data, size));
     }
+};
+
+// process-wide lru cache of the patterns the free functions compile, keyed by the
+// pattern text and the options, safe to use from several threads
+class PatternCache
+{
+  private:
+    using Key = std::tuple<std::string, Engine, bool, std::size_t, std::size_t>;
+
+    mutable std::mutex lock;
+    std::size_t limit, hit_count, miss_count;
+    // most recently used first
+    std::list<std::pair<Key, Pattern>> lru;
+    std::map<Key, decltype(lru)::iterator> index;
 
-    std::vector<std::string> matches(const std::string &str)
+    void evict()
     {
-        if (begin)
+        while (lru.size() > limit)
         {
-            return {match(str)};
+            index.erase(lru.back().first);
+            lru.pop_back();
         }
+    }
 
-        std::vector<std::string> res;
-        for (std::size_t i = 0; i < str.size(); ++i)
+  public:
+    PatternCache(std::size_t capacity = 256) : limit(capacity), hit_count(0), miss_count(0) {}
+
+    // the compiled pattern, compiled here on a miss
+    Pattern get(const std::string &pattern, const Options &options = Options())
+    {
+        Key key(pattern, options.engine, options.minimize, options.cache_capacity, options.dfa_capacity);
         {
-            auto tmp = match(str.substr(i));
-            if (!tmp.empty())
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = index.find(key);
+            if (it != index.end())
             {
-                res.push_back(tmp);
-                i += tmp.size() - 1;
+                ++hit_count;
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->second;
             }
+            ++miss_count;
         }
 
-        return res;
+        // compiled unlocked, a thread that got here first wins the slot
+        Pattern compiled(pattern, options);
+        std::lock_guard<std::mutex> guard(lock);
+        if (!limit)
+        {
+            return compiled;
+        }
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+        lru.emplace_front(key, compiled);
+        index.emplace(key, lru.begin());
+        evict();
+        return compiled;
+    }
+
+    std::size_t capacity() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return limit;
+    }
+
+    // 0 turns the cache off, the patterns handed out stay alive while they are in use
+    void set_capacity(std::size_t capacity)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        limit = capacity;
+        evict();
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return lru.size();
+    }
+
+    std::size_t hits() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return hit_count;
+    }
+
+    std::size_t misses() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return miss_count;
+    }
+
+    // drops every pattern and zeroes the counters
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        lru.clear();
+        index.clear();
+        hit_count = miss_count = 0;
     }
 };
 
-inline std::string match(const std::string &pattern, const std::string &str)
+inline PatternCache &pattern_cache()
+{
+    static PatternCache cache;
+    return cache;
+}
+
+inline std::string match(const std::string &pattern, std::string_view str, const Options &options = Options())
 {
-    return Pattern(pattern).match(str);
+    return pattern_cache().get(pattern, options).match(str);
 }
 
-inline std::string search(const std::string &pattern, const std::string &str)
+inline std::string search(const std::string &pattern, std::string_view str, const Options &options = Options())
 {
-    return Pattern(pattern).search(str);
+    return pattern_cache().get(pattern, options).search(str);
 }
 
-inline std::string replace(const std::string &pattern, const std::string &str, const std::string &target)
+inline std::string replace(const std::string &pattern, std::string_view str, std::string_view target,
+    const Options &options = Options())
 {
-    return Pattern(pattern).replace(str, target);
+    return pattern_cache().get(pattern, options).replace(str, target);
 }
 
-inline std::vector<std::string> matches(const std::string &pattern, const std::string &str)
+inline std::vector<std::string> matches(const std::string &pattern, std::string_view str,
+    const Options &options = Options())
 {
-    return Pattern(pattern).matches(str);
+    return pattern_cache().get(pattern, options).matches(str);
 }
 } // namespace cre
 #endif // COMMONREGEX_HPP
@@ -4,6 +4,9 @@
 
 #include "cre.hpp"
 
+#define CRE_GEN_NO_MAIN
+#include "cre-gen.cpp"
+
 
 using namespace std;
 
@@ -102,6 +105,13 @@ TEST(QUALIFIER)
 	ASSERT("2{3}", "2222", "222");
 	ASSERT("2{3,}", "22", "");
 	ASSERT("2{3,}", "22222", "22222");
+	ASSERT("a{2,4}", "a", "");
+	ASSERT("a{2,4}", "aaaaa", "aaaa");
+	ASSERT("a{2,2}", "aaa", "aa");
+	ASSERT("[0-9a-f]{12}", "0123456789abc", "0123456789ab");
+	ASSERT("[0-9a-f]{12}", "0123456789a", "");
+	ASSERT("x{0,10}y", "xxxxxxxxxxy", "xxxxxxxxxxy");
+	ASSERT("x{0,10}y", "xxxxxxxxxxxy", "");
 
 	ASSERT("<meta[^>]+>", "<meta name hahah >", "<meta name hahah >");
 END
@@ -167,6 +177,183 @@ TEST(COMPLEX)
 	}
 END
 
+TEST(NO_MINIMIZE)
+	{
+		cre::Options options;
+		options.minimize = false;
+		auto pattern = cre::Pattern("((a|b|c)+(1|2|3)*0?(abc)?)+", options);
+		ASSERT_WP("abc1230abcdefg", "abc1230abc");
+		ASSERT_WP("cccbbbaaadefg", "cccbbbaaa");
+		PRTL; assert(pattern.stats().minimize_time.count() == 0 && pattern.stats().subset_time.count() > 0);
+	}
+END
+
+TEST(LAZY_DFA)
+	{
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		auto pattern = cre::Pattern("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)", options);
+		ASSERT_WP("bbabbbbbbbbbaab", "bbabbbbbbbbb");
+		ASSERT_WP("bbbbbbbbbbbbbbbb", "");
+	}
+
+	{
+		// a cache this small is flushed on nearly every new state
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		options.cache_capacity = 64;
+		auto pattern = cre::Pattern("(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}", options);
+		ASSERT_WP("255.255.255.0", "255.255.255.0");
+		ASSERT_WP("256.255.255.0", "");
+		ASSERT_WP("192.168.1.1", "192.168.1.1");
+	}
+END
+
+TEST(NFA)
+	{
+		cre::Options options;
+		options.engine = cre::Engine::NFA;
+		std::string text = "ipv4: 192.168.1.1 abcd foo 25 ERROR: 42 bcx barbaz a\n";
+		for (auto str: {"(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}", "foo|barbaz|bar", "[a-z]+",
+			"(abcd|bc)x|bcd", "[0-9]{2,}", "[a-z]{2,4}", "[^ ]{3}", "b.{0,20}a", "^ipv4", "a\n$", "x.*z"})
+		{
+			cre::Pattern dfa(str), nfa(str, options);
+			PRTL; assert(nfa.matches(text) == dfa.matches(text));
+			for (std::size_t pos = 0; pos <= text.size(); pos += 5)
+			{
+				PRTL; assert(nfa.search_span(text, pos).offset == dfa.search_span(text, pos).offset);
+				PRTL; assert(nfa.match(text.substr(pos)) == dfa.match(text.substr(pos)));
+			}
+		}
+	}
+
+	{
+		// a repetition this large is one counting state, its dfa would not fit in memory
+		cre::Options options;
+		options.engine = cre::Engine::NFA;
+		auto pattern = cre::Pattern("x[a-z]{2,200}y", options);
+		std::string text = "ax" + std::string(150, 'x') + "y " + "xy xaay";
+		auto spans = pattern.matches_span(text);
+		PRTL; assert(spans.size() == 2 && spans[0].offset == 1 && spans[0].length == 152);
+		PRTL; assert(spans[1].offset == 157 && spans[1].length == 4);
+		PRTL; assert(cre::Pattern("^[0-9a-f]{64}$", options).match(std::string(64, 'e')).size() == 64);
+		PRTL; assert(cre::Pattern("^[0-9a-f]{64}$", options).match(std::string(65, 'e')).empty());
+
+		// counts are taken as written, one too large to read is rejected
+		for (auto engine: {cre::Engine::DFA, cre::Engine::NFA})
+		{
+			options.engine = engine;
+			cre::Pattern exact("a{1001}", options);
+			PRTL; assert(exact.match(std::string(1001, 'a')).size() == 1001 && exact.match(std::string(1000, 'a')).empty());
+			PRTL; assert(cre::Pattern("a{2,1500}", options).search(std::string(2000, 'a')).size() == 1500);
+		}
+
+		// the nfa engine never writes a repetition out, its groups are counted too
+		options.engine = cre::Engine::NFA;
+		cre::Pattern wide("x(.{0,10000000})y", options);
+		std::string far = "a x" + std::string(1000, 'b') + "y";
+		PRTL; assert(wide.stats().nfa_states < 16 && wide.stats().bytes < (1 << 20));
+		PRTL; assert(wide.search(far).size() == 1002 && wide.search_groups(far)[1].length == 1000);
+		for (auto str: {"a{99999999999}", "(ab){1000000}"})
+		{
+			bool rejected = false;
+			try
+			{
+				cre::Pattern pattern(str);
+			}
+			catch (const std::out_of_range &)
+			{
+				rejected = true;
+			}
+			PRTL; assert(rejected);
+		}
+	}
+END
+
+TEST(DFA_CAPACITY)
+	{
+		// the dfa of this pattern has some thousand states, one that does not fit runs on the nfa
+		cre::Options options;
+		options.dfa_capacity = 1 << 16;
+		std::string text = "abbbbbbbabbbbbbbb aaaaaaaaaaaaaaaa";
+		auto str = "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)";
+		cre::Pattern fallen(str, options), pattern(str);
+		PRTL; assert(fallen.engine() == cre::Engine::NFA && pattern.engine() == cre::Engine::DFA);
+		PRTL; assert(fallen.matches(text) == pattern.matches(text) && fallen.search_span(text, 3).offset == pattern.search_span(text, 3).offset);
+		PRTL; assert(fallen.save().empty() && cre::Pattern("a|b", options).engine() == cre::Engine::DFA);
+
+		// a repetition whose states alone take more is never determinized
+		cre::Pattern counted("xa{5000}", options);
+		PRTL; assert(counted.engine() == cre::Engine::NFA && counted.stats().subset_states == 0);
+		PRTL; assert(counted.search_span("yx" + std::string(5001, 'a')).length == 5001);
+
+		// the unanchored automata take a state per span of a run of a, or per set of threads
+		// alive, past a bound they are determinized while scanning and the dfa engine stays
+		cre::Options nfa_options;
+		nfa_options.engine = cre::Engine::NFA;
+		std::string runs = "rabbit runs " + std::string(450, 'a') + " by the river b" + std::string(30, 'x') + "ab" + std::string(700, 'a');
+		for (auto looping: {"a{400}", "b.{0,20}a", "r[a-z ]{2,50}s"})
+		{
+			cre::Pattern dfa(looping), nfa(looping, nfa_options);
+			PRTL; assert(dfa.engine() == cre::Engine::DFA && dfa.stats().dfa_states < 5000 && dfa.save().empty());
+			PRTL; assert(dfa.matches(runs) == nfa.matches(runs));
+			for (std::size_t pos = 0; pos <= runs.size(); pos += 97)
+			{
+				auto span = dfa.search_span(runs, pos);
+				PRTL; assert(span.offset == nfa.search_span(runs, pos).offset && span.length == nfa.search_span(runs, pos).length);
+			}
+		}
+
+		cre::PatternSet fallen_set({str, "z$"}, options), set({str, "z$"});
+		PRTL; assert(fallen_set.engine() == cre::Engine::LAZY_DFA && set.engine() == cre::Engine::DFA);
+		PRTL; assert(fallen_set.matches(text) == set.matches(text) && fallen_set.matches("bz") == set.matches("bz"));
+	}
+END
+
+TEST(JIT)
+	{
+		cre::Options options;
+		options.engine = cre::Engine::JIT;
+		std::string text = "ipv4: 192.168.1.1 abcd foo 25 ERROR: 42 bcx barbaz a\n";
+		for (auto str: {"(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}", "foo|barbaz|bar", "[a-z]+",
+			"(abcd|bc)x|bcd", "ERROR: [0-9]+", "^ipv4", "a\n$", "[^ ]*", "x.*z"})
+		{
+			cre::Pattern dfa(str), jit(str, options);
+			PRTL; assert(jit.matches(text) == dfa.matches(text));
+			for (std::size_t pos = 0; pos <= text.size(); pos += 7)
+			{
+				PRTL; assert(jit.search_span(text, pos).offset == dfa.search_span(text, pos).offset);
+				PRTL; assert(jit.match(text.substr(pos)) == dfa.match(text.substr(pos)));
+			}
+		}
+	}
+END
+
+TEST(STATS)
+	{
+		cre::Pattern pattern("ab|cd");
+		auto &stats = pattern.stats();
+		PRTL; assert(stats.nodes == 7 && stats.nfa_states == 10 && stats.byte_classes == 5);
+		PRTL; assert(stats.subset_states >= stats.dfa_states && stats.dfa_states > 3 && stats.bytes > sizeof(pattern));
+		PRTL; assert(stats.parse_time.count() >= 0 && stats.subset_time.count() > 0);
+		PRTL; assert(pattern.dot().find("digraph dfa") == 0 && pattern.dot().find("[label=\"b\"]") != std::string::npos);
+
+		auto image = std::make_shared<std::string>(pattern.save());
+		auto loaded = *cre::Pattern::load(*image, image);
+		PRTL; assert(loaded.stats().dfa_states == stats.dfa_states && loaded.stats().nodes == 0);
+		PRTL; assert(loaded.search("xxcdab") == "cd");
+
+		cre::Options options;
+		options.engine = cre::Engine::NFA;
+		cre::Pattern counting("x[a-c]{2,50}", options);
+		PRTL; assert(counting.stats().nfa_states == 4 && counting.stats().dfa_states == 0);
+		PRTL; assert(counting.dot().find("label=\"a-c {2,50}\"") != std::string::npos);
+		options.engine = cre::Engine::LAZY_DFA;
+		PRTL; assert(cre::Pattern("x[a-c]{2,50}", options).stats().nfa_states > 100);
+	}
+END
+
+
 
 //--TEST SEARCH METHOD--
 
@@ -174,6 +361,12 @@ END
 TEST(SEARCH_M)
 	ASSERT_SC("ab*c+", "aaaaaabbbbaaabababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababababbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbababcccccc", "abcccccc");
 	ASSERT_SC("(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}", "ipv4: 192.168.1.1", "192.168.1.1");
+	ASSERT_SC("abcd|c", "xabcd", "abcd");
+	ASSERT_SC("b+$", "abbcbb", "bb");
+	ASSERT_SC("^b+", "abbcbb", "");
+	ASSERT_SC("a*", "bbb", "");
+	ASSERT_SC("ERROR: [0-9]+", "ERROR ERROR: x ERROR: 42", "ERROR: 42");
+	ASSERT_SC("[XYZ][a-z]+", "abc Y Zed", "Zed");
 END
 
 
@@ -197,6 +390,434 @@ TEST(MATCHES_M)
 			"accccb"
 		})
 	);
+	ASSERT_MCS("a|a[^z]*z", "aaaa", vector<string>({"a", "a", "a", "a"}));
+	ASSERT_MCS("c*", "acca", vector<string>({"cc"}));
+	ASSERT_MCS("foo|barbaz|bar|qux", "xxbarbazfoo quxbar", vector<string>({"barbaz", "foo", "qux", "bar"}));
+	ASSERT_MCS("(abcd|bc)x|bcd", "abcdbcx bcdx abcx", vector<string>({"bcd", "bcx", "bcd", "bcx"}));
+END
+
+
+//--TEST LITERAL PREFILTERS--
+
+TEST(LITERALS)
+	{
+		vector<string> words;
+		string pattern, text;
+		for (int i = 0; i < 100; ++i)
+		{
+			words.push_back("w" + std::to_string(i * 7919 % 1000) + "x");
+			pattern += (i ? "|" : "") + words.back();
+		}
+		for (int i = 0; i < 100; ++i)
+		{
+			text += "w" + std::to_string(i) + "y " + words[(i * 37) % 100] + " ";
+		}
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		auto dfa = cre::Pattern(pattern);
+		auto lazy = cre::Pattern(pattern, options);
+		auto res = dfa.matches(text);
+		PRTL; assert(res.size() == 100);
+		for (int i = 0; i < 100; ++i)
+		{
+			PRTL; assert(res[i] == words[(i * 37) % 100]);
+		}
+		PRTL; assert(lazy.matches(text) == res);
+
+		// literals that fan out from a shared prefix or a few first bytes are found by
+		// those, the ones of many first bytes by a search for all of them
+		options.engine = cre::Engine::NFA;
+		string many;
+		for (int i = 0; i < 100; ++i)
+		{
+			many += (i ? "|" : "") + string(1, 'a' + i % 26) + std::to_string(i * 7919 % 1000);
+		}
+		text += " took 12ms, xaz xdz xbbz x z xbz q871 k2231";
+		for (auto str: {"x[a-c]z", "took [0-9]+ms", "x[^ ]*z", "w[0-9]", "ab|cd|ef|gh", many.c_str()})
+		{
+			PRTL; assert(cre::Pattern(str).matches(text) == cre::Pattern(str, options).matches(text));
+		}
+	}
+END
+
+
+//--TEST GROUPS--
+
+TEST(GROUPS)
+	{
+		auto pattern = cre::Pattern("(?<user>[a-z]+)@(?<host>[a-z]+)(\\.[a-z]+)?");
+		std::string str = "mail bob@example.org now";
+		auto groups = pattern.search_groups(str);
+		PRTL; assert(pattern.groups() == 4 && groups.size() == 4);
+		PRTL; assert(groups[0].of(str) == "bob@example.org");
+		PRTL; assert(groups[pattern.group("user")].of(str) == "bob");
+		PRTL; assert(groups[pattern.group("host")].of(str) == "example");
+		PRTL; assert(groups[3].offset == 16 && groups[3].of(str) == ".org");
+		PRTL; assert(!pattern.search_groups("bob@example")[3]);
+		PRTL; assert(pattern.group("port") == 0 && pattern.search_groups("nothing").empty());
+
+		// the earlier branch first, the last round of a repetition
+		groups = cre::Pattern("(a|ab)(c|bcd)(d*)").match_groups("abcd");
+		PRTL; assert(groups[1].length == 1 && groups[2].length == 3 && groups[3] && !groups[3].length);
+		groups = cre::Pattern("([0-9]+\\.)+").match_groups("10.0.12.");
+		PRTL; assert(groups[1].offset == 5 && groups[1].length == 3);
+
+		// a reference to a named group is no group of its own
+		auto ipv4 = cre::Pattern("(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}");
+		groups = ipv4.search_groups("ip 10.2.3.4");
+		PRTL; assert(ipv4.groups() == 3 && groups[1].length == 2 && groups[2].offset == 9);
+		PRTL; assert(cre::Pattern("a+").match_groups("aa").size() == 1);
+
+		// a counted repetition takes one more round first, {n,} counts no further than n
+		groups = cre::Pattern("([a-f]{2,3})([a-f]*)").match_groups("abcde");
+		PRTL; assert(groups[1].length == 3 && groups[2].offset == 3 && groups[2].length == 2);
+		groups = cre::Pattern("x([0-9]{2,})([0-9]?)").match_groups("x12345");
+		PRTL; assert(groups[1].length == 5 && groups[2] && !groups[2].length);
+		groups = cre::Pattern("(a{2})+").match_groups("aaaa");
+		PRTL; assert(groups[1].offset == 2 && groups[1].length == 2);
+	}
+END
+
+
+//--TEST SPANS AND BUFFERS--
+
+TEST(SPAN)
+	{
+		auto pattern = cre::Pattern("a.b+");
+		const char buffer[] = "xxa\0bbyya-b";
+		auto str = std::string_view(buffer, sizeof(buffer) - 1);
+		auto spans = pattern.matches_span(str);
+		PRTL; assert(spans.size() == 2);
+		PRTL; assert(spans[0].offset == 2 && spans[0].length == 4);
+		PRTL; assert(spans[1].offset == 8 && spans[1].length == 3);
+		PRTL; assert(pattern.search_span(str, 5).offset == 8);
+		PRTL; assert(!pattern.search_span("xxx"));
+		PRTL; assert(pattern.match(buffer + 2, 4) == string("a\0bb", 4));
+	}
+END
+
+
+//--TEST SHARED PATTERNS--
+
+TEST(SHARED)
+	{
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		options.cache_capacity = 64;
+		const auto pattern = cre::Pattern("[0-9]+\\.[0-9]+", options);
+		const auto copy = pattern;
+		cre::Cache cache;
+		PRTL; assert(pattern.search("v 1.25 x") == "1.25");
+		PRTL; assert(copy.search_span("v 1.25 x", 0, cache).offset == 2);
+		PRTL; assert(copy.matches_span("1.2 3.4 5", cache).size() == 2);
+		PRTL; assert(pattern.match_span("12.5", cache).length == 4);
+		PRTL; assert(cre::Pattern("a+").match_span("aab", cache).length == 2);
+
+		// the pattern scanned by several threads at once, through their thread-local
+		// caches and through caches of their own, finds what one thread does alone
+		std::string text;
+		for (int i = 0; i < 400; ++i)
+		{
+			text += std::to_string(i * 7) + "." + std::to_string(i % 13) + (i % 3 ? " v" : " ") + "1.";
+		}
+		auto serial = pattern.matches_span(text);
+		auto first = pattern.search_span(text, text.size() / 2);
+		std::atomic<int> mismatches(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&]
+			{
+				cre::Cache own;
+				for (int round = 0; round < 4; ++round)
+				{
+					auto spans = round % 2 ? copy.matches_span(text, own) : pattern.matches_span(text);
+					bool same = spans.size() == serial.size();
+					for (std::size_t i = 0; same && i < spans.size(); ++i)
+					{
+						same = spans[i].offset == serial[i].offset && spans[i].length == serial[i].length;
+					}
+					auto span = round % 2 ? copy.search_span(text, text.size() / 2, own) : pattern.search_span(text, text.size() / 2);
+					mismatches += !same || span.offset != first.offset || span.length != first.length;
+				}
+			});
+		}
+		for (auto &thread: threads)
+		{
+			thread.join();
+		}
+		PRTL; assert(serial.size() == 400 && mismatches == 0);
+
+		// a thread alternating between programs keeps a cache of each until it has MAX_LOCAL
+		std::thread([]
+		{
+			auto &first = cre::Cache::local(UINT64_MAX), &second = cre::Cache::local(UINT64_MAX - 1);
+			PRTL; assert(&first != &second && &cre::Cache::local(UINT64_MAX) == &first);
+			PRTL; assert(&cre::Cache::local(UINT64_MAX - 1) == &second);
+		}).join();
+	}
+END
+
+
+//--TEST PARALLEL SCANS--
+
+TEST(PARALLEL)
+	{
+		std::string text;
+		for (int i = 0; i < 50; ++i)
+		{
+			text += std::to_string(i * 37) + (i % 3 ? "." : " foo") + std::string(i % 5, 'a') + "bar";
+		}
+
+		cre::Parallel parallel;
+		parallel.threads = 4;
+		parallel.chunk_size = 3;
+		for (auto engine: {cre::Engine::DFA, cre::Engine::LAZY_DFA, cre::Engine::JIT, cre::Engine::NFA})
+		{
+			cre::Options options;
+			options.engine = engine;
+			for (auto str: {"[0-9]+\\.[0-9]+", "a*bar|foo", "o.*a", "7[^b]+", "^[0-9]+", "r$", "foobar"})
+			{
+				cre::Pattern pattern(str, options);
+				auto serial = pattern.matches_span(text), spans = pattern.matches_span(text, parallel);
+				PRTL; assert(serial.size() == spans.size());
+				for (std::size_t i = 0; i < serial.size(); ++i)
+				{
+					PRTL; assert(serial[i].offset == spans[i].offset && serial[i].length == spans[i].length);
+				}
+				for (std::size_t pos: {0, 5, 100})
+				{
+					auto span = pattern.search_span(text, pos, parallel);
+					PRTL; assert(span.offset == pattern.search_span(text, pos).offset);
+					PRTL; assert(span.length == pattern.search_span(text, pos).length);
+				}
+			}
+		}
+	}
+END
+
+TEST(PARALLEL_SPANNING)
+	{
+		// one match over every chunk: no chunk's scan may run on to the end of the input
+		std::string text(1 << 16, 'a');
+		cre::Parallel parallel;
+		parallel.threads = 4;
+		parallel.chunk_size = 1024;
+		for (auto engine: {cre::Engine::DFA, cre::Engine::LAZY_DFA, cre::Engine::NFA})
+		{
+			cre::Options options;
+			options.engine = engine;
+			for (auto str: {"a[^z]*", "a[^z]*z"})
+			{
+				cre::Pattern pattern(str, options);
+				auto serial = pattern.matches_span(text), spans = pattern.matches_span(text, parallel);
+				auto span = pattern.search_span(text, 0, parallel);
+				PRTL; assert(serial.size() == spans.size());
+				for (std::size_t i = 0; i < serial.size(); ++i)
+				{
+					PRTL; assert(serial[i].offset == spans[i].offset && serial[i].length == spans[i].length);
+				}
+				PRTL; assert(span.offset == pattern.search_span(text).offset);
+				PRTL; assert(span.length == pattern.search_span(text).length);
+			}
+		}
+	}
+END
+
+
+//--TEST STREAMS--
+
+TEST(STREAM)
+	{
+		std::string text = "GET /a 200 12ms\nGET /bb 404 7ms\nPOST /c 200 130ms\n";
+		for (auto engine: {cre::Engine::DFA, cre::Engine::LAZY_DFA, cre::Engine::JIT, cre::Engine::NFA})
+		{
+			cre::Options options;
+			options.engine = engine;
+			options.cache_capacity = 64;
+			for (auto str: {"[0-9]+ms", "/[a-z]+ [0-9]+", "GET|POST /c", "\\n[A-Z]+", "^GET", "ms\\n$", "[0-9]{2,3}ms"})
+			{
+				cre::Pattern pattern(str, options);
+				auto serial = pattern.matches_span(text);
+				std::vector<cre::Span> spans;
+				cre::Stream stream(pattern, [&](cre::Span span)
+				{
+					spans.push_back(span);
+				});
+				for (std::size_t piece: {1, 3, 64})
+				{
+					spans.clear();
+					for (std::size_t i = 0; i < text.size(); i += piece)
+					{
+						stream.feed(std::string_view(text).substr(i, piece));
+					}
+					PRTL; assert(stream.size() == text.size());
+					stream.finish();
+					PRTL; assert(serial.size() == spans.size());
+					for (std::size_t i = 0; i < serial.size(); ++i)
+					{
+						PRTL; assert(serial[i].offset == spans[i].offset && serial[i].length == spans[i].length);
+					}
+				}
+			}
+		}
+	}
+
+	{
+		// a match under way in the same state as an earlier one is dropped, unless a
+		// match ending between their starts would cut the earlier one only
+		cre::Pattern pattern("xyz(q*w)?|zq+c|q+c");
+		std::string text = "cybcxyzqcxy";
+		std::vector<cre::Span> spans;
+		cre::Stream stream(pattern, [&](cre::Span span)
+		{
+			spans.push_back(span);
+		});
+		stream.feed(text);
+		stream.finish();
+		PRTL; assert(spans.size() == 2 && spans[0].offset == 4 && spans[0].length == 3);
+		PRTL; assert(spans[1].offset == 7 && spans[1].length == 2);
+
+		// the matches under way stay few however long the input
+		cre::Stream open(cre::Pattern("a[^z]*z|b[^y]*y"), [](cre::Span) {});
+		open.feed("a");
+		std::size_t most = 0;
+		for (int i = 0; i < 100000; ++i)
+		{
+			open.feed("b");
+			most = std::max(most, open.pending());
+		}
+		PRTL; assert(most <= 2);
+	}
+END
+
+
+//--TEST FILES--
+
+TEST(FILES)
+	{
+		std::string text = "one 1\ntwo 22\nthree 333\n", path = "cre_file_test.tmp";
+		auto out = std::fopen(path.c_str(), "wb");
+		std::fwrite(text.data(), 1, text.size(), out);
+		std::fclose(out);
+		{
+			cre::File file(path);
+			PRTL; assert(file && file.view() == text);
+			PRTL; assert(cre::Pattern("[0-9]+\\n").matches_span(file.view()).size() == 3);
+		}
+		std::remove(path.c_str());
+		PRTL; assert(!cre::File(path));
+	}
+END
+
+
+//--TEST SAVED PATTERNS--
+
+TEST(SAVE)
+	{
+		std::string text = "ipv4 address: 123.123.123.123, 10.0.0.1 and 1.2.3";
+		for (auto str: {"(?:<sec>25[0-5]|2[0-4][0-9]|1[0-9]{2}|[1-9][0-9]|[0-9])(\\.(?:<sec>)){3}", "foo|bar|[0-9]+", "^ipv4", "[0-9]$"})
+		{
+			cre::Pattern pattern(str);
+			auto image = pattern.save();
+			auto loaded = cre::Pattern::load(image);
+			PRTL; assert(loaded && loaded->matches(text) == pattern.matches(text));
+			PRTL; assert(loaded->match(text) == pattern.match(text) && loaded->search(text) == pattern.search(text));
+
+			// an image not aligned to four bytes is read into copies
+			auto shifted = std::make_shared<std::string>(" " + image);
+			auto copied = cre::Pattern::load(std::string_view(*shifted).substr(1), shifted);
+			PRTL; assert(copied && copied->matches(text) == pattern.matches(text));
+
+			// with no owner given the tables are copied, the image may go away
+			auto kept = cre::Pattern::load(std::string(image));
+			PRTL; assert(kept && kept->matches(text) == pattern.matches(text) && kept->search(text) == pattern.search(text));
+
+			PRTL; assert(!cre::Pattern::load(image.substr(0, image.size() - 4)));
+			image[0] = 'C';
+			PRTL; assert(!cre::Pattern::load(image));
+		}
+
+		// a mapped image is read in place and kept alive by the pattern
+		std::string path = "cre_save_test.tmp", image = cre::Pattern("[0-9]+").save();
+		auto out = std::fopen(path.c_str(), "wb");
+		std::fwrite(image.data(), 1, image.size(), out);
+		std::fclose(out);
+		{
+			auto file = std::make_shared<cre::File>(path);
+			auto loaded = cre::Pattern::load(file->view(), file);
+			PRTL; assert(loaded && loaded->matches(text) == cre::Pattern("[0-9]+").matches(text));
+		}
+		std::remove(path.c_str());
+
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		PRTL; assert(cre::Pattern("a+", options).save().empty());
+		PRTL; assert(!cre::Pattern::load(""));
+	}
+END
+
+TEST(GEN)
+	{
+		// cre-gen builds the searchers of a counted repeat in full, they always come out
+		for (auto str: {"a{1,20}b", "x[a-c]{2,50}", "a{2,30}", "ERROR|WARN"})
+		{
+			auto matchers = generate("m", str);
+			PRTL; assert(matchers && matchers->find("namespace m\n") != std::string::npos);
+			PRTL; assert(matchers->find("inline bool find(") != std::string::npos);
+		}
+	}
+END
+
+
+//--TEST PATTERN SETS--
+
+TEST(PATTERN_SET)
+	{
+		vector<string> patterns = {"ab+c", "^x", "d$", "[0-9]+", "zz", "a|ab+c"};
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		for (auto set: {cre::PatternSet(patterns), cre::PatternSet(patterns, options)})
+		{
+			PRTL; assert(set.size() == 6);
+			PRTL; assert(set.matches("xabbc 12 d") == vector<bool>({true, true, true, true, false, true}));
+			PRTL; assert(set.matches("abc d!") == vector<bool>({true, false, false, false, false, true}));
+			PRTL; assert(set.matches(" x zz") == vector<bool>({false, false, false, false, true, false}));
+			PRTL; assert(set.matches("") == vector<bool>(6, false));
+		}
+	}
+END
+
+
+//--TEST PATTERN CACHE--
+
+TEST(PATTERN_CACHE)
+	{
+		auto &cache = cre::pattern_cache();
+		cache.clear();
+		ASSERT("a+", "aab", "aa");
+		ASSERT_SC("a+", "baa", "aa");
+		PRTL; assert(cache.misses() == 1 && cache.hits() == 1 && cache.size() == 1);
+
+		cre::Options options;
+		options.engine = cre::Engine::LAZY_DFA;
+		PRTL; assert(cre::match("a+", "aab", options) == "aa");
+		PRTL; assert(cache.misses() == 2 && cache.size() == 2);
+
+		cache.set_capacity(1);
+		PRTL; assert(cache.size() == 1);
+		ASSERT("b", "b", "b");
+		ASSERT("a+", "a", "a");
+		PRTL; assert(cache.misses() == 4 && cache.hits() == 1);
+
+		cache.set_capacity(0);
+		ASSERT("a+", "a", "a");
+		PRTL; assert(cache.size() == 0 && cache.misses() == 5);
+
+		cache.set_capacity(256);
+		cache.clear();
+		PRTL; assert(cache.hits() == 0 && cache.misses() == 0);
+	}
 END
 
 